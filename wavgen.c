@@ -2,32 +2,74 @@
 Simple WAV generator (16-bit PCM, mono).
 
 Build:
-  gcc -O2 -Wall -Wextra -std=c11 wavgen.c -lm -o wavgen
+  gcc -O2 -Wall -Wextra -std=c11 wavgen.c -lm -pthread -o wavgen
 
 Examples:
   ./wavgen sine out.wav 44100 2.0 440 0.8
   ./wavgen noise out.wav 48000 3.0 0 0.4
+  ./wavgen pink out.wav 48000 3600 0 1.0
   ./wavgen impulse out.wav 44100 1.0 0 0.9
   ./wavgen silence out.wav 44100 2.0 0 0
   ./wavgen chirp out.wav 44100 3.0 200 0.8 2000
+  ./wavgen expsweep sweep.wav 48000 10.0 20 0.5 20000
+  ./wavgen saw out.wav 48000 2.0 110 0.5
+  ./wavgen --interp linear square out.wav 48000 2.0 55 0.5 7000
+  ./wavgen --table cycle.txt wavetable out.wav 48000 2.0 220 0.5
+  ./wavgen --voices 64 --detune 30 blepsaw out.wav 48000 5.0 110 0.3
+  ./wavgen --pw 0.5 --pwm-rate 0.5 --pwm-depth 0.4 bleppulse out.wav 48000 4.0 110 0.5
+  ./wavgen --partials organ.txt additive out.wav 48000 5.0 110 0.3
+  ./wavgen --fm epiano.txt fm out.wav 48000 3.0 220 0.5
+  ./wavgen --amp-env adsr:0.01,0.2,0.6,0.5 saw out.wav 48000 2.0 220 0.5
+  ./wavgen --manifest jobs.txt --threads 8
 
 Args:
-  mode out.wav sample_rate seconds f1 amplitude [f2]
+  [options] mode out.wav sample_rate seconds f1 amplitude [f2]
+  --manifest <file> [--threads N] : one job per line, same arguments as
+                          above ("#" comments); rendered in parallel
+
+Options:
+  --interp linear|cubic : table interpolation (default cubic)
+  --table <file>        : one cycle for wavetable mode (numbers, any length)
+  --voices N, --detune cents        : detuned unison for the blep modes
+  --pw w, --pwm-rate Hz, --pwm-depth d : bleppulse width and its LFO
+  --partials <file>     : additive partial list, "freq amp [phase]" per line
+  --additive osc|ifft   : additive engine (default: ifft from 64 partials)
+  --accum 32|64         : sine, chirp: integer phase and sine table instead of
+                          a double phase and sin()
+  --amp-env <env>       : amplitude envelope, any mode
+  --freq-env <env>      : frequency ratio envelope (> 0), oscillator modes
+                          <env> is adsr:A,D,S,R or a file of lines
+                          "seconds value [lin|exp]"
+  --fm <file>           : fm patch, one operator per line:
+                          ratio level attack decay sustain release targets [fb]
 
 Modes:
   sine     : f1 = frequency (Hz)
   noise    : f1 ignored
+  pink, brown, blue, violet
+           : coloured noise, f1 ignored; RMS = amplitude / 5
   impulse  : f1 ignored (impulse at sample 0)
   silence  : amplitude ignored
   chirp    : f1 = start Hz, f2 = end Hz (required)
+  expsweep : exponential sweep f1 -> f2 Hz (required), for wavproc01 deconvolve
+  saw, square, triangle, wavetable
+           : band-limited table oscillators; f1 = Hz, glide to f2 if given
+  blepsaw, blepsquare, bleppulse, bleptri
+           : PolyBLEP/PolyBLAMP oscillators, same arguments as the table modes
+  additive : sum of the --partials list; f1 = frequency scale
+  fm       : --fm operator patch on f1 (glides to f2 if given)
 */
 
+#define _POSIX_C_SOURCE 200809L     // strdup, clock_gettime, sysconf
+
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <time.h>
+#include <unistd.h>
+#include <pthread.h>
 
 // suppose v = 0x1234;
 // we want to write b[0] = 0x34 and b[1] = 0x12
@@ -96,13 +138,6 @@ static int16_t float_to_s16(float x) {
     return (int16_t)v;
 }
 
-// produces random number between 0.0 and 1.0. This will be mapped
-// to [-1.0, 1.0] in the actual loop. [0,] is more general and can
-// be used in other ways.
-static float frand_uniform(void) {
-    return (float)rand() / (float)RAND_MAX; /* [0,1] */
-}
-
 
 // RIFF stores integersin little-endian byte order so
 // the least significant byte goes first.
@@ -136,35 +171,1706 @@ static void write_wav_header(FILE *f, uint32_t sample_rate, uint32_t num_samples
     write_u32_le(f, data_bytes);
 }
 
+// samples are rendered and written this many at a time (same block size
+// as wavproc01); one fwrite per block instead of one per sample
+#define BLOCK_SAMPLES 4096
+
+// the mode string is looked up once, not strcmp()'d for every sample
+typedef enum {
+    MODE_SINE, MODE_NOISE, MODE_IMPULSE, MODE_SILENCE, MODE_CHIRP,
+    MODE_SAW, MODE_SQUARE, MODE_TRIANGLE, MODE_WAVETABLE,
+    MODE_BLEPSAW, MODE_BLEPSQUARE, MODE_BLEPPULSE, MODE_BLEPTRI,
+    MODE_ADDITIVE, MODE_FM,
+    MODE_PINK, MODE_BROWN, MODE_BLUE, MODE_VIOLET, MODE_EXPSWEEP
+} gen_mode_t;
+
+static const struct { const char *name; gen_mode_t mode; } mode_names[] = {
+    { "sine", MODE_SINE }, { "noise", MODE_NOISE }, { "impulse", MODE_IMPULSE },
+    { "silence", MODE_SILENCE }, { "chirp", MODE_CHIRP }, { "saw", MODE_SAW },
+    { "square", MODE_SQUARE }, { "triangle", MODE_TRIANGLE }, { "wavetable", MODE_WAVETABLE },
+    { "blepsaw", MODE_BLEPSAW }, { "blepsquare", MODE_BLEPSQUARE },
+    { "bleppulse", MODE_BLEPPULSE }, { "bleptri", MODE_BLEPTRI },
+    { "additive", MODE_ADDITIVE }, { "fm", MODE_FM },
+    { "pink", MODE_PINK }, { "brown", MODE_BROWN }, { "blue", MODE_BLUE },
+    { "violet", MODE_VIOLET }, { "expsweep", MODE_EXPSWEEP },
+};
+
+/*
+Band-limited wavetables.
+
+A naive saw (the phase mapped straight onto a ramp) has harmonics all the
+way up, and every one above Nyquist folds back down as an inharmonic
+alias. Instead each waveform is kept as a set of single-cycle tables, one
+per octave ("mipmaps"): table 0 holds harmonics 1..1023, table 1 holds
+1..512, table 2 1..256 and so on down to a pure sine. A note plays from
+the richest table whose top harmonic still lands below Nyquist.
+
+The tables are built once at startup from the waveform's Fourier series
+(for a user table, from its DFT) and are read-only after that, so any
+number of voices can share one bank.
+
+Each table has one guard sample before the cycle and three after it, so
+4-point cubic interpolation never has to wrap its index, even at a
+position of exactly TABLE_SIZE (a phase a hair under 1 rounds up to it
+when it is converted to float).
+*/
+#define TABLE_SIZE   2048
+#define TABLE_LEVELS 11         // 1023, 512, 256, ... 1 harmonics
+#define MAX_HARMONIC 1023
+
+typedef struct {
+    float *t[TABLE_LEVELS];     // TABLE_SIZE + 4 floats each, cycle starts at [1]
+} wt_bank_t;
+
+static int wt_harmonics(int level) {
+    return level == 0 ? MAX_HARMONIC : 1024 >> level;
+}
+
+// harmonic k (1..MAX_HARMONIC) of the waveform is a[k] cos(kx) + b[k] sin(kx)
+static int wt_build(wt_bank_t *bank, const double *a, const double *b) {
+    const double two_pi = 2.0 * acos(-1.0);
+    double peak = 0.0;
+    for (int lv = 0; lv < TABLE_LEVELS; lv++) {
+        float *t = malloc((TABLE_SIZE + 4) * sizeof *t);
+        if (!t) return -1;
+        int h = wt_harmonics(lv);
+        for (int j = 0; j < TABLE_SIZE; j++) {
+            double x = two_pi * (double)j / TABLE_SIZE;
+            double c1 = cos(x), s1 = sin(x), c = c1, s = s1, v = 0.0;
+            // cos(kx), sin(kx) for k = 1, 2, ... by rotating (c, s) by x
+            // each step: no sin() call per harmonic
+            for (int k = 1; k <= h; k++) {
+                v += a[k] * c + b[k] * s;
+                double cn = c * c1 - s * s1;
+                s = s * c1 + c * s1;
+                c = cn;
+            }
+            t[j + 1] = (float)v;
+            if (fabs(v) > peak) peak = fabs(v);
+        }
+        bank->t[lv] = t;
+    }
+    // one scale for every level (the overshoot of the richest table sets
+    // it), so the level does not jump when the table changes
+    float scale = peak > 0.0 ? (float)(1.0 / peak) : 1.0f;
+    for (int lv = 0; lv < TABLE_LEVELS; lv++) {
+        float *t = bank->t[lv];
+        for (int j = 1; j <= TABLE_SIZE; j++) t[j] *= scale;
+        t[0] = t[TABLE_SIZE];
+        t[TABLE_SIZE + 1] = t[1];
+        t[TABLE_SIZE + 2] = t[2];
+        t[TABLE_SIZE + 3] = t[3];
+    }
+    return 0;
+}
+
+static void wt_free(wt_bank_t *bank) {
+    for (int lv = 0; lv < TABLE_LEVELS; lv++) free(bank->t[lv]);
+}
+
+// Fourier series of the classic shapes, each running -1..1
+static void wt_series(gen_mode_t mode, double *a, double *b) {
+    const double pi = acos(-1.0);
+    for (int k = 0; k <= MAX_HARMONIC; k++) a[k] = b[k] = 0.0;
+    for (int k = 1; k <= MAX_HARMONIC; k++) {
+        if (mode == MODE_SAW) {
+            b[k] = -2.0 / (pi * k);                          // ramp up
+        } else if (mode == MODE_SQUARE && (k & 1)) {
+            b[k] = 4.0 / (pi * k);
+        } else if (mode == MODE_TRIANGLE && (k & 1)) {
+            b[k] = ((k / 2) & 1 ? -8.0 : 8.0) / (pi * pi * k * k);
+        }
+    }
+}
+
+// one cycle of any length as whitespace-separated numbers; its DFT gives
+// the harmonics (those below the cycle's own Nyquist)
+static int wt_series_file(const char *path, double *a, double *b) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror("wavetable");
+        return -1;
+    }
+    size_t n = 0, cap = 0;
+    double *x = NULL, v;
+    while (fscanf(f, "%lf", &v) == 1) {
+        if (n == 65536) {
+            fprintf(stderr, "wavetable: more than 65536 values.\n");
+            fclose(f);
+            free(x);
+            return -1;
+        }
+        if (n == cap) {
+            cap = cap ? 2 * cap : 1024;
+            double *nx = realloc(x, cap * sizeof *nx);
+            if (!nx) { fclose(f); free(x); return -1; }
+            x = nx;
+        }
+        x[n++] = v;
+    }
+    fclose(f);
+    if (n < 3) {
+        fprintf(stderr, "wavetable: need at least 3 values.\n");
+        free(x);
+        return -1;
+    }
+
+    const double two_pi = 2.0 * acos(-1.0);
+    for (int k = 0; k <= MAX_HARMONIC; k++) a[k] = b[k] = 0.0;
+    for (int k = 1; k <= MAX_HARMONIC && 2 * (size_t)k < n; k++) {
+        double c1 = cos(two_pi * k / (double)n), s1 = sin(two_pi * k / (double)n);
+        double c = 1.0, s = 0.0, sa = 0.0, sb = 0.0;
+        for (size_t j = 0; j < n; j++) {
+            sa += x[j] * c;
+            sb += x[j] * s;
+            double cn = c * c1 - s * s1;
+            s = s * c1 + c * s1;
+            c = cn;
+        }
+        a[k] = 2.0 * sa / (double)n;
+        b[k] = 2.0 * sb / (double)n;
+    }
+    free(x);
+    return 0;
+}
+
+// the richest table whose top harmonic at frequency f stays below Nyquist
+static int wt_level(double f, uint32_t sample_rate) {
+    double hmax = 0.5 * (double)sample_rate / fabs(f);
+    for (int lv = 0; lv < TABLE_LEVELS; lv++) {
+        if (wt_harmonics(lv) <= hmax) return lv;
+    }
+    return TABLE_LEVELS - 1;
+}
+
+/* Table readers. pos[] is the position in the cycle, 0..TABLE_SIZE; t
+   points at the first cycle sample (guards at t[-1], t[TABLE_SIZE..+2]).
+   Fixed-length loops over restrict pointers: with -mavx2 (or -march=native)
+   and -O3 the table reads become gathers. */
+static void wt_read_linear(const float *restrict t, const float *restrict pos,
+                           float *restrict x, float amp) {
+    for (size_t i = 0; i < BLOCK_SAMPLES; i++) {
+        int32_t j = (int32_t)pos[i];
+        float fr = pos[i] - (float)j;
+        x[i] = amp * (t[j] + fr * (t[j + 1] - t[j]));
+    }
+}
+
+// 4-point Catmull-Rom: continuous slope, so much less interpolation hiss
+static void wt_read_cubic(const float *restrict t, const float *restrict pos,
+                          float *restrict x, float amp) {
+    for (size_t i = 0; i < BLOCK_SAMPLES; i++) {
+        int32_t j = (int32_t)pos[i];
+        float fr = pos[i] - (float)j;
+        float y0 = t[j - 1], y1 = t[j], y2 = t[j + 1], y3 = t[j + 2];
+        float c1 = 0.5f * (y2 - y0);
+        float c2 = y0 - 2.5f * y1 + 2.0f * y2 - 0.5f * y3;
+        float c3 = 0.5f * (y3 - y0) + 1.5f * (y1 - y2);
+        x[i] = amp * (((c3 * fr + c2) * fr + c1) * fr + y1);
+    }
+}
+
+/*
+PolyBLEP oscillators.
+
+A lower-memory alternative to the tables: compute the naive waveform from
+the phase, then smooth each discontinuity with a short polynomial
+correction spread over the sample either side of it. A jump (the saw's
+wrap, the pulse's edges) gets the PolyBLEP residual: the difference
+between a hard step and a step smoothed by a triangular pulse one sample
+wide each side. A corner (where the triangle's slope flips) gets
+PolyBLAMP, that residual integrated once more. There are no tables, only
+a few multiplies per sample, and the aliasing is far below the naive
+waveform's for all but the highest notes.
+
+Up to MAX_VOICES detuned copies play at once. Voices are processed
+BLEP_LANES at a time in fixed-width lane loops whose conditions are all
+selects, not branches, so the compiler turns each into vector code: a
+64-voice detuned saw is 8 lane-loop iterations per sample.
+*/
+#define MAX_VOICES 64
+#define BLEP_LANES 8
+
+typedef struct {
+    int    voices;              // rounded up to BLEP_LANES; extra lanes have gain 0
+    double phase[MAX_VOICES];   // cycles, 0..1
+    float  ratio[MAX_VOICES];   // detune, as a frequency multiplier
+    float  gain[MAX_VOICES];
+    float  pw, pwm_depth;       // pulse width and how far the LFO swings it
+    double pwm_rate, lfo_phase; // LFO Hz, and its phase in cycles
+} blep_t;
+
+/* 1.0f when x < 0, else 0.0f, read off the sign bit.
+   The lane loops select with these instead of ?: on a float compare:
+   with gcc's default -ftrapping-math a float compare stays a branch, and
+   a loop with a branch in it is not vectorized. */
+static inline float neg_mask(float x) {
+    uint32_t u;
+    memcpy(&u, &x, sizeof u);
+    return (float)(int32_t)(u >> 31);
+}
+
+static inline double neg_mask_d(double x) {
+    uint64_t u;
+    memcpy(&u, &x, sizeof u);
+    return (double)(int64_t)(u >> 63);
+}
+
+// residual for a jump of -2 at t = 0 (the saw's wrap); t in cycles, dt = f/sr
+static inline float poly_blep(float t, float dt, float inv_dt) {
+    float a = t * inv_dt, b = (t - 1.0f) * inv_dt;
+    float after = 2.0f * a - a * a - 1.0f;          // t < dt
+    float before = b * b + 2.0f * b + 1.0f;         // t > 1 - dt
+    return after * neg_mask(t - dt) + before * neg_mask((1.0f - dt) - t);
+}
+
+// residual for a slope change of +1 per cycle at t = 0 (the above, integrated and halved)
+static inline float poly_blamp(float t, float dt, float inv_dt) {
+    float a = 1.0f - t * inv_dt, b = 1.0f + (t - 1.0f) * inv_dt;
+    float after = dt * a * a * a * (1.0f / 6.0f);
+    float before = dt * b * b * b * (1.0f / 6.0f);
+    return after * neg_mask(t - dt) + before * neg_mask((1.0f - dt) - t);
+}
+
+static void blep_init(blep_t *b, int voices, double detune_cents, double pw,
+                      double pwm_rate, double pwm_depth) {
+    memset(b, 0, sizeof *b);
+    b->voices = (voices + BLEP_LANES - 1) / BLEP_LANES * BLEP_LANES;
+    // padding lanes still run (silently), so give them a sane frequency
+    for (int v = 0; v < MAX_VOICES; v++) b->ratio[v] = 1.0f;
+    for (int v = 0; v < voices; v++) {
+        // spread evenly over +-detune/2; golden-ratio start phases so the
+        // voices do not all start on the same edge (and output stays repeatable)
+        double spread = voices > 1 ? (double)v / (double)(voices - 1) - 0.5 : 0.0;
+        b->ratio[v] = (float)pow(2.0, detune_cents * spread / 1200.0);
+        b->gain[v] = (float)(1.0 / sqrt((double)voices));
+        b->phase[v] = voices > 1 ? fmod(0.6180339887498949 * v, 1.0) : 0.0;
+    }
+    b->pw = (float)pw;
+    b->pwm_depth = (float)pwm_depth;
+    b->pwm_rate = pwm_rate;
+}
+
+/*
+Real FFT (inverse only here), the same design as in wavproc01: an n-point
+real transform is an n/2-point complex FFT plus one O(n) split pass.
+*/
+typedef struct {
+    size_t    n, m;             // real size, complex size n/2
+    uint32_t *rev;              // bit-reversal permutation of 0..m-1
+    float    *twr, *twi;        // stage twiddles: stage with half-size h at [h-1, 2h-1)
+    float    *rtr, *rti;        // exp(-2 pi i k/n), k = 0..m
+} fft_plan_t;
+
+static void fft_plan_free(fft_plan_t *p) {
+    if (!p) return;
+    free(p->rev);
+    free(p->twr);
+    free(p->twi);
+    free(p->rtr);
+    free(p->rti);
+    free(p);
+}
+
+// n a power of two >= 4; NULL if out of memory
+static fft_plan_t *fft_plan_new(size_t n) {
+    const double pi = acos(-1.0);
+    fft_plan_t *p = calloc(1, sizeof *p);
+    if (!p) return NULL;
+    p->n = n;
+    p->m = n / 2;
+    size_t m = p->m;
+    p->rev = malloc(m * sizeof *p->rev);
+    p->twr = malloc(m * sizeof *p->twr);
+    p->twi = malloc(m * sizeof *p->twi);
+    p->rtr = malloc((m + 1) * sizeof *p->rtr);
+    p->rti = malloc((m + 1) * sizeof *p->rti);
+    if (!p->rev || !p->twr || !p->twi || !p->rtr || !p->rti) {
+        fft_plan_free(p);
+        return NULL;
+    }
+    int bits = 0;
+    while (((size_t)1 << bits) < m) bits++;
+    for (size_t i = 0; i < m; i++) {
+        uint32_t r = 0;
+        for (int b = 0; b < bits; b++) r |= (uint32_t)((i >> b) & 1) << (bits - 1 - b);
+        p->rev[i] = r;
+    }
+    for (size_t h = 1; h < m; h <<= 1) {
+        for (size_t k = 0; k < h; k++) {
+            double ang = -pi * (double)k / (double)h;
+            p->twr[h - 1 + k] = (float)cos(ang);
+            p->twi[h - 1 + k] = (float)sin(ang);
+        }
+    }
+    for (size_t k = 0; k <= m; k++) {
+        double ang = -2.0 * pi * (double)k / (double)n;
+        p->rtr[k] = (float)cos(ang);
+        p->rti[k] = (float)sin(ang);
+    }
+    return p;
+}
+
+// in-place forward complex FFT of size p->m
+static void fft_complex(const fft_plan_t *p, float *re, float *im) {
+    const size_t m = p->m;
+    for (size_t i = 0; i < m; i++) {
+        size_t r = p->rev[i];
+        if (i < r) {
+            float t = re[i]; re[i] = re[r]; re[r] = t;
+            t = im[i]; im[i] = im[r]; im[r] = t;
+        }
+    }
+    for (size_t h = 1; h < m; h <<= 1) {
+        const float *wr = p->twr + h - 1;
+        const float *wi = p->twi + h - 1;
+        for (size_t j = 0; j < m; j += 2 * h) {
+            float *ar = re + j, *ai = im + j;
+            float *br = re + j + h, *bi = im + j + h;
+            for (size_t k = 0; k < h; k++) {
+                float tr = br[k] * wr[k] - bi[k] * wi[k];
+                float ti = br[k] * wi[k] + bi[k] * wr[k];
+                br[k] = ar[k] - tr;
+                bi[k] = ai[k] - ti;
+                ar[k] += tr;
+                ai[k] += ti;
+            }
+        }
+    }
+}
+
+/* Spectrum xr/xi[0..n/2] back to x[0..n-1], the exact inverse of an
+   unnormalized forward DFT. zr/zi are scratch of n/2 floats each. */
+static void fft_real_inverse(const fft_plan_t *p, const float *xr, const float *xi,
+                             float *zr, float *zi, float *x) {
+    const size_t m = p->m;
+    for (size_t k = 0; k < m; k++) {
+        float ar = xr[k], ai = xi[k];
+        float br = xr[m - k], bi = -xi[m - k];
+        float er = 0.5f * (ar + br), ei = 0.5f * (ai + bi);
+        float dr = 0.5f * (ar - br), di = 0.5f * (ai - bi);
+        float orr = dr * p->rtr[k] + di * p->rti[k];
+        float oi = di * p->rtr[k] - dr * p->rti[k];
+        zr[k] = er - oi;
+        zi[k] = -(ei + orr);        // conjugated for the forward FFT
+    }
+    fft_complex(p, zr, zi);
+    const float scale = 1.0f / (float)m;
+    for (size_t k = 0; k < m; k++) {
+        x[2 * k] = zr[k] * scale;
+        x[2 * k + 1] = -zi[k] * scale;
+    }
+}
+
+/*
+Additive synthesis.
+
+The partials are kept as structure-of-arrays (one array per field), so a
+run of ADD_LANES partials is a run of vector lanes. Each partial is a
+recursive oscillator: a unit phasor (c, s) turned by (cos w, sin w) every
+sample, four multiplies and two adds and no sin() per sample. Turning a
+float phasor slowly drifts its length and angle, so at the start of every
+block it is set afresh from the partial's exact double phase, and the
+error never outlives a block.
+
+With thousands of partials that per-sample work is still one rotation
+per partial per sample. The inverse-FFT path (Rodet and Depalle's FFT^-1
+synthesis) instead adds every partial to a spectrum as the few bins its
+windowed sinusoid occupies, once per frame, and lets one inverse FFT turn
+the spectrum into ADD_FFT samples. A partial then costs 9 bins per
+ADD_HOP samples. The window is a 4-term Blackman-Harris (main lobe 4
+bins either side, sidelobes 92 dB down). Of each frame only the central
+half is kept, divided by the window and overlap-added under triangles.
+*/
+#define ADD_LANES   8
+#define ADD_FFT     4096
+#define ADD_HOP     (ADD_FFT / 4)
+#define LOBE_BINS   4
+#define LOBE_OVER   64          // lobe table points per bin
+#define ADD_IFFT_FROM 64        // default to the inverse FFT from this many partials
+
+typedef struct {
+    size_t   n;                 // partials, padded to ADD_LANES with amplitude 0
+    float   *amp, *cw, *sw;     // amplitude, per-sample rotation
+    double  *phase, *w;         // exact sine phase at the next block (or frame), rad/sample
+    int      ifft;
+    fft_plan_t *plan;
+    float   *lobe;              // window transform at 0..LOBE_BINS bins
+    float   *shape;             // triangle / window over the kept half frame
+    float   *xr, *xi, *zr, *zi, *frame, *ola;
+} add_t;
+
+static void add_free(add_t *a) {
+    free(a->amp); free(a->cw); free(a->sw); free(a->phase); free(a->w);
+    fft_plan_free(a->plan);
+    free(a->lobe); free(a->shape);
+    free(a->xr); free(a->xi); free(a->zr); free(a->zi); free(a->frame); free(a->ola);
+}
+
+static double blackman_harris(size_t i, size_t n) {
+    const double two_pi = 2.0 * acos(-1.0);
+    double x = two_pi * (double)i / (double)n;
+    return 0.35875 - 0.48829 * cos(x) + 0.14128 * cos(2.0 * x) - 0.01168 * cos(3.0 * x);
+}
+
+static void add_frame(add_t *a);
+
+/* Partial file: one partial per line, "freq amp [phase]" (phase in radians,
+   sine phase); '#' starts a comment. Frequencies are multiplied by scale.
+   Partials at or above Nyquist are dropped (they would alias). ifft < 0
+   picks the engine from the partial count. */
+static int add_load(add_t *a, const char *path, double scale, uint32_t sample_rate, int ifft) {
+    memset(a, 0, sizeof *a);
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror("partials");
+        return -1;
+    }
+    const double two_pi = 2.0 * acos(-1.0);
+    size_t cap = 0, n = 0, dropped = 0;
+    char line[256];
+    while (fgets(line, sizeof line, f)) {
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+        double fr, am, ph = 0.0;
+        int got = sscanf(line, "%lf %lf %lf", &fr, &am, &ph);
+        if (got <= 0) continue;
+        if (got < 2) {
+            fprintf(stderr, "partials: need \"freq amp [phase]\" per line.\n");
+            fclose(f);
+            return -1;
+        }
+        fr *= scale;
+        if (fr <= 0.0 || fr >= 0.5 * (double)sample_rate) {
+            dropped++;
+            continue;
+        }
+        if (n + ADD_LANES > cap) {
+            cap = cap ? 2 * cap : 1024;
+            float *na = realloc(a->amp, cap * sizeof *na);
+            if (na) a->amp = na;
+            double *np = realloc(a->phase, cap * sizeof *np);
+            if (np) a->phase = np;
+            double *nw = realloc(a->w, cap * sizeof *nw);
+            if (nw) a->w = nw;
+            if (!na || !np || !nw) {
+                fclose(f);
+                return -1;
+            }
+        }
+        a->amp[n] = (float)am;
+        a->phase[n] = fmod(ph, two_pi);
+        a->w[n] = two_pi * fr / (double)sample_rate;
+        n++;
+    }
+    fclose(f);
+    if (dropped) fprintf(stderr, "partials: dropped %zu at or above Nyquist.\n", dropped);
+    if (n == 0) {
+        fprintf(stderr, "partials: no partials.\n");
+        return -1;
+    }
+    a->n = (n + ADD_LANES - 1) / ADD_LANES * ADD_LANES;
+    for (size_t i = n; i < a->n; i++) {
+        a->amp[i] = 0.0f;
+        a->phase[i] = 0.0;
+        a->w[i] = 0.0;
+    }
+    a->cw = malloc(a->n * sizeof *a->cw);
+    a->sw = malloc(a->n * sizeof *a->sw);
+    if (!a->cw || !a->sw) return -1;
+    for (size_t i = 0; i < a->n; i++) {
+        a->cw[i] = (float)cos(a->w[i]);
+        a->sw[i] = (float)sin(a->w[i]);
+    }
+
+    a->ifft = ifft >= 0 ? ifft : n >= ADD_IFFT_FROM;
+    if (!a->ifft) return 0;
+    const size_t bins = ADD_FFT / 2 + 1, nlobe = LOBE_BINS * LOBE_OVER + 2;
+    a->plan = fft_plan_new(ADD_FFT);
+    a->lobe = malloc(nlobe * sizeof *a->lobe);
+    a->shape = malloc(2 * ADD_HOP * sizeof *a->shape);
+    a->xr = malloc(bins * sizeof *a->xr);
+    a->xi = malloc(bins * sizeof *a->xi);
+    a->zr = malloc(ADD_FFT / 2 * sizeof *a->zr);
+    a->zi = malloc(ADD_FFT / 2 * sizeof *a->zi);
+    a->frame = malloc(ADD_FFT * sizeof *a->frame);
+    a->ola = calloc(2 * ADD_HOP, sizeof *a->ola);
+    if (!a->plan || !a->lobe || !a->shape || !a->xr || !a->xi || !a->zr || !a->zi ||
+        !a->frame || !a->ola) return -1;
+    // transform of the window centred on 0 (real, even), x bins from the peak
+    double *wn = malloc(ADD_FFT * sizeof *wn);
+    if (!wn) return -1;
+    for (size_t i = 0; i < ADD_FFT; i++) wn[i] = blackman_harris(i, ADD_FFT);
+    for (size_t j = 0; j < nlobe; j++) {
+        double x = (double)j / LOBE_OVER, sum = 0.0;
+        for (size_t i = 0; i < ADD_FFT; i++) {
+            double m = (double)i - ADD_FFT / 2;
+            sum += wn[i] * cos(two_pi * x * m / ADD_FFT);
+        }
+        a->lobe[j] = (float)sum;
+    }
+    for (size_t j = 0; j < 2 * ADD_HOP; j++) {
+        double m = (double)j - ADD_HOP;
+        a->shape[j] = (float)((1.0 - fabs(m) / ADD_HOP) / wn[ADD_FFT / 2 - ADD_HOP + j]);
+    }
+    free(wn);
+    // frame 0 is centred on sample 0: its first half lies before the file
+    add_frame(a);
+    memmove(a->ola, a->ola + ADD_HOP, ADD_HOP * sizeof *a->ola);
+    memset(a->ola + ADD_HOP, 0, ADD_HOP * sizeof *a->ola);
+    return 0;
+}
+
+// one block by recursive oscillators, ADD_LANES partials at a time
+static void add_render_osc(add_t *a, float *x, float gain) {
+    const double two_pi = 2.0 * acos(-1.0);
+    memset(x, 0, BLOCK_SAMPLES * sizeof *x);
+    for (size_t p0 = 0; p0 < a->n; p0 += ADD_LANES) {
+        float c[ADD_LANES], s[ADD_LANES], cw[ADD_LANES], sw[ADD_LANES], am[ADD_LANES];
+        for (int l = 0; l < ADD_LANES; l++) {
+            double ph = a->phase[p0 + l];
+            c[l] = (float)cos(ph);
+            s[l] = (float)sin(ph);
+            cw[l] = a->cw[p0 + l];
+            sw[l] = a->sw[p0 + l];
+            am[l] = gain * a->amp[p0 + l];
+            a->phase[p0 + l] = fmod(ph + a->w[p0 + l] * BLOCK_SAMPLES, two_pi);
+        }
+        for (size_t i = 0; i < BLOCK_SAMPLES; i++) {
+            float y[ADD_LANES];
+            for (int l = 0; l < ADD_LANES; l++) {
+                y[l] = am[l] * s[l];
+                float cn = c[l] * cw[l] - s[l] * sw[l];
+                s[l] = s[l] * cw[l] + c[l] * sw[l];
+                c[l] = cn;
+            }
+            x[i] += ((y[0] + y[1]) + (y[2] + y[3])) + ((y[4] + y[5]) + (y[6] + y[7]));
+        }
+    }
+}
+
+/* Add the next frame to the overlap-add buffer. A sinusoid A sin(w m + ph)
+   under the window, centred in the frame, has the spectrum
+   (-1)^k (A/2) e^(i(ph - pi/2)) W(k - b) plus its mirror image at -b,
+   where b is w in bins and W the window transform. Lobe bins that fall
+   below 0 or above n/2 belong to the mirror image and fold back
+   conjugated. */
+static void add_frame(add_t *a) {
+    const double two_pi = 2.0 * acos(-1.0), half_pi = 0.5 * acos(-1.0);
+    const int half = ADD_FFT / 2;
+    memset(a->xr, 0, (half + 1) * sizeof *a->xr);
+    memset(a->xi, 0, (half + 1) * sizeof *a->xi);
+    for (size_t p = 0; p < a->n; p++) {
+        double ph = a->phase[p];
+        a->phase[p] = fmod(ph + a->w[p] * ADD_HOP, two_pi);
+        if (a->amp[p] == 0.0f) continue;
+        float ar = 0.5f * a->amp[p] * (float)cos(ph - half_pi);
+        float ai = 0.5f * a->amp[p] * (float)sin(ph - half_pi);
+        double b = a->w[p] * ADD_FFT / two_pi;
+        int k0 = (int)ceil(b - LOBE_BINS), k1 = (int)floor(b + LOBE_BINS);
+        for (int k = k0; k <= k1; k++) {
+            float pos = (float)fabs((double)k - b) * LOBE_OVER;
+            int j = (int)pos;
+            float wv = a->lobe[j] + (pos - (float)j) * (a->lobe[j + 1] - a->lobe[j]);
+            if (k & 1) wv = -wv;
+            float vr = ar * wv, vi = ai * wv;
+            if (k >= 0 && k <= half) { a->xr[k] += vr; a->xi[k] += vi; }
+            if (k <= 0) { a->xr[-k] += vr; a->xi[-k] -= vi; }
+            if (k >= half) { a->xr[ADD_FFT - k] += vr; a->xi[ADD_FFT - k] -= vi; }
+        }
+    }
+    fft_real_inverse(a->plan, a->xr, a->xi, a->zr, a->zi, a->frame);
+    const float *mid = a->frame + half - ADD_HOP;
+    for (size_t j = 0; j < 2 * ADD_HOP; j++) a->ola[j] += mid[j] * a->shape[j];
+}
+
+// one block by inverse FFT: frame k completes samples [(k-1) hop, k hop)
+static void add_render_ifft(add_t *a, float *x, float gain) {
+    for (size_t c = 0; c < BLOCK_SAMPLES; c += ADD_HOP) {
+        add_frame(a);
+        for (size_t j = 0; j < ADD_HOP; j++) x[c + j] = gain * a->ola[j];
+        memmove(a->ola, a->ola + ADD_HOP, ADD_HOP * sizeof *a->ola);
+        memset(a->ola + ADD_HOP, 0, ADD_HOP * sizeof *a->ola);
+    }
+}
+
+/*
+FM (phase modulation) synthesis.
+
+Up to FM_MAX_OPS sine operators. Each runs at f1 * ratio and has an ADSR
+envelope; it feeds the phase of the operators it targets (its level is
+then the modulation index, in radians) and/or the output (its level is
+then an amplitude). An operator can also feed back into itself.
+
+Operators run in an order where every modulator comes before its
+targets, a control segment of FM_CTRL samples at a time: envelopes and
+the glide move per segment (ramped linearly inside it), and each
+operator's segment is one fixed-length loop over samples. Phases are
+32-bit integer accumulators (they wrap for free), and the sine is a
+polynomial, not libm's sin(), so those loops vectorize. Only an operator
+with feedback needs its previous output each sample; it runs a scalar
+loop.
+*/
+#define FM_MAX_OPS 8
+#define FM_CTRL    64
+#define FM_OUT     FM_MAX_OPS      // target bit for the output
+
+typedef struct {
+    float    ratio, level, fb;
+    float    a, d, s, r;           // ADSR: seconds, seconds, level, seconds
+    uint32_t targets;              // bit i: modulates operator i; bit FM_OUT: output
+    uint32_t phase;                // 2^32 = one cycle
+    float    prev[2];              // last two outputs, for feedback
+} fm_op_t;
+
+typedef struct {
+    int      nops;
+    fm_op_t  op[FM_MAX_OPS];
+    int      order[FM_MAX_OPS];
+    double   gate_off;             // release starts here (seconds)
+} fm_t;
+
+/* sin(2 pi t) for t in [-0.5, 0.5]: fold onto [0, 0.25] and use the Taylor
+   polynomial to degree 9 there (error under 4e-6). fabsf and copysignf
+   are bit operations, so this is branch-free. */
+static inline float sin_cycles(float t) {
+    float a = fabsf(t);
+    float b = 0.25f - fabsf(a - 0.25f);
+    float x = 6.28318531f * b, x2 = x * x;
+    float p = x * (1.0f + x2 * (-1.0f / 6.0f + x2 * (1.0f / 120.0f
+              + x2 * (-1.0f / 5040.0f + x2 * (1.0f / 362880.0f)))));
+    return copysignf(p, t);
+}
+
+/* Phase (accumulator plus modulation, in cycles) reduced to [-0.5, 0.5].
+   Adding and subtracting 1.5 * 2^23 rounds a float to the nearest
+   integer without a call to rintf() (needs default rounding and no
+   -ffast-math). */
+static inline float fm_reduce(uint32_t p, float mod) {
+    float x = (float)(int32_t)p * (1.0f / 4294967296.0f) + mod * 0.159154943f;
+    return x - ((x + 12582912.0f) - 12582912.0f);
+}
+
+static float fm_env(const fm_op_t *op, double t, double gate_off) {
+    double e;
+    double te = t < gate_off ? t : gate_off;
+    if (te < op->a) e = te / op->a;
+    else if (te < op->a + op->d) e = 1.0 + (op->s - 1.0) * (te - op->a) / op->d;
+    else e = op->s;
+    if (t > gate_off) {
+        double k = op->r > 0.0 ? 1.0 - (t - gate_off) / op->r : 0.0;
+        e *= k > 0.0 ? k : 0.0;
+    }
+    return (float)e;
+}
+
+/* Patch file: one operator per line,
+     ratio level attack decay sustain release targets [feedback]
+   operators numbered from 1 in file order; targets is a comma list of
+   operator numbers and/or "out"; '#' starts a comment. */
+static int fm_load(fm_t *fm, const char *path, double seconds) {
+    memset(fm, 0, sizeof *fm);
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror("fm");
+        return -1;
+    }
+    char line[256];
+    while (fgets(line, sizeof line, f)) {
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+        fm_op_t op;
+        memset(&op, 0, sizeof op);
+        char targets[128];
+        int got = sscanf(line, "%f %f %f %f %f %f %127s %f", &op.ratio, &op.level,
+                         &op.a, &op.d, &op.s, &op.r, targets, &op.fb);
+        if (got <= 0) continue;
+        if (got < 7 || fm->nops == FM_MAX_OPS) {
+            fprintf(stderr, "fm: bad line, or more than %d operators.\n", FM_MAX_OPS);
+            fclose(f);
+            return -1;
+        }
+        for (char *tok = strtok(targets, ","); tok; tok = strtok(NULL, ",")) {
+            int id = atoi(tok);
+            if (!strcmp(tok, "out")) op.targets |= 1u << FM_OUT;
+            else if (id >= 1 && id <= FM_MAX_OPS && id != fm->nops + 1) op.targets |= 1u << (id - 1);
+            else {
+                fprintf(stderr, "fm: bad target \"%s\" (self-modulation is the feedback column).\n", tok);
+                fclose(f);
+                return -1;
+            }
+        }
+        if (op.a < 0.0f || op.d < 0.0f || op.r < 0.0f) {
+            fprintf(stderr, "fm: envelope times must be >= 0.\n");
+            fclose(f);
+            return -1;
+        }
+        fm->op[fm->nops++] = op;
+    }
+    fclose(f);
+    if (fm->nops == 0) {
+        fprintf(stderr, "fm: no operators.\n");
+        return -1;
+    }
+
+    // modulators before their targets (Kahn's algorithm); a cycle is an error
+    int indeg[FM_MAX_OPS] = { 0 }, n = 0;
+    for (int i = 0; i < fm->nops; i++) {
+        for (int j = 0; j < fm->nops; j++) if (fm->op[i].targets >> j & 1) indeg[j]++;
+        if ((fm->op[i].targets >> FM_MAX_OPS) == 0 && (fm->op[i].targets & ((1u << fm->nops) - 1)) == 0) {
+            fprintf(stderr, "fm: operator %d goes nowhere.\n", i + 1);
+            return -1;
+        }
+    }
+    for (int done = 0; done < fm->nops; done++) {
+        int pick = -1;
+        for (int i = 0; i < fm->nops && pick < 0; i++) if (indeg[i] == 0) pick = i;
+        if (pick < 0) {
+            fprintf(stderr, "fm: operators modulate each other in a loop.\n");
+            return -1;
+        }
+        indeg[pick] = -1;
+        fm->order[n++] = pick;
+        for (int j = 0; j < fm->nops; j++) if (fm->op[pick].targets >> j & 1) indeg[j]--;
+    }
+
+    // every release ends with the file
+    double rmax = 0.0;
+    for (int i = 0; i < fm->nops; i++) if (fm->op[i].r > rmax) rmax = fm->op[i].r;
+    fm->gate_off = seconds - rmax > 0.0 ? seconds - rmax : 0.0;
+    return 0;
+}
+
+// one operator over one control segment
+static void fm_op_segment(fm_op_t *op, uint32_t inc, const float *restrict mod,
+                          float e0, float de, float *restrict out) {
+    const uint32_t p0 = op->phase;
+    const float level = op->level;
+    if (op->fb == 0.0f) {
+        for (uint32_t i = 0; i < FM_CTRL; i++) {
+            float t = fm_reduce(p0 + i * inc, mod[i]);
+            out[i] = level * (e0 + de * (float)i) * sin_cycles(t);
+        }
+    } else {
+        // feedback from the mean of the last two outputs, which keeps high
+        // feedback from breaking into a squeal
+        float y1 = op->prev[0], y2 = op->prev[1];
+        for (uint32_t i = 0; i < FM_CTRL; i++) {
+            float t = fm_reduce(p0 + i * inc, mod[i] + op->fb * 0.5f * (y1 + y2));
+            float y = (e0 + de * (float)i) * sin_cycles(t);
+            y2 = y1;
+            y1 = y;
+            out[i] = level * y;
+        }
+        op->prev[0] = y1;
+        op->prev[1] = y2;
+    }
+    op->phase = p0 + FM_CTRL * inc;
+}
+
+/*
+Coloured noise, for hours of it at a time.
+
+rand() is one serial call per sample (and takes a lock in glibc, so it
+does not belong on the manifest's render threads), so all the noise modes
+use their own generator: NOISE_LANES independent xorshift32 streams,
+advanced side by side (shifts and xors only, so the loop vectorizes) and
+interleaved into the block. Each job draws one seed from rand() while it
+is parsed, on the main thread, so it is still different on every run.
+
+  noise  : the white streams themselves, uniform in [-1, 1).
+
+  pink   : Voss-McCartney. PINK_ROWS random rows, row k redrawn every
+           2^(k+1) samples (the row is the number of trailing zeros of a
+           sample counter, so exactly one row changes per sample), plus
+           a fresh white row each sample. A running sum keeps it O(1);
+           -3 dB per octave down to about sr / 2^(PINK_ROWS+1).
+  brown  : leaky integrator of white noise, -6 dB per octave above a
+           BROWN_HZ corner (the leak keeps it from wandering off to DC).
+  blue   : first difference of pink, +3 dB per octave.
+  violet : first difference of white, +6 dB per octave.
+
+Pink and brown are recurrences, so after the vectorized random numbers
+they take one scalar pass of a few operations per sample. All four are
+scaled to an RMS of NOISE_RMS * amp (-14 dBFS at amp 1), so peaks up to
+5 sigma fit. Blue and violet can't clip at amp <= 1. Pink is a sum of
+PINK_ROWS + 1 uniforms and can in principle reach 7.1 sigma (1.43 at amp
+1), but at amp 1 and 48 kHz only clips a few samples an hour; brown is
+close to Gaussian and clips one or two samples a minute. amp <= 0.7
+keeps pink strictly inside full scale.
+*/
+#define NOISE_LANES 8
+#define PINK_ROWS   16
+#define BROWN_HZ    10.0
+#define NOISE_RMS   0.2f
+
+typedef struct {
+    uint32_t s[NOISE_LANES];       // xorshift32 states, never 0
+    float    rows[PINK_ROWS];
+    float    sum;                  // of rows[]
+    uint32_t counter;
+    float    prev;                 // last white or pink value, for blue and violet
+    float    y;                    // brown integrator
+    float    leak, k;              // brown: y = leak * y + k * white
+    float    r[BLOCK_SAMPLES];     // pink: the row values for this block
+} noise_t;
+
+// x[0..BLOCK_SAMPLES) = white noise, uniform in [-1, 1)
+static void noise_white(noise_t *ns, float *restrict x) {
+    uint32_t s[NOISE_LANES];
+    memcpy(s, ns->s, sizeof s);
+    for (size_t i = 0; i < BLOCK_SAMPLES; i += NOISE_LANES) {
+        for (int l = 0; l < NOISE_LANES; l++) {
+            s[l] ^= s[l] << 13;
+            s[l] ^= s[l] >> 17;
+            s[l] ^= s[l] << 5;
+            x[i + l] = (float)(int32_t)s[l] * (1.0f / 2147483648.0f);
+        }
+    }
+    memcpy(ns->s, s, sizeof s);
+}
+
+static void noise_init(noise_t *ns, uint32_t sample_rate, uint32_t seed) {
+    memset(ns, 0, sizeof *ns);
+    // spread the one seed over the lanes (a step of the golden ratio, then
+    // the murmur3 finalizer), so neighbouring seeds give unrelated streams
+    for (int l = 0; l < NOISE_LANES; l++) {
+        uint32_t v = seed + 0x9E3779B9u * (uint32_t)(l + 1);
+        v = (v ^ (v >> 16)) * 0x85EBCA6Bu;
+        v = (v ^ (v >> 13)) * 0xC2B2AE35u;
+        ns->s[l] = (v ^ (v >> 16)) | 1u;
+    }
+    const double two_pi = 2.0 * acos(-1.0);
+    ns->leak = (float)(1.0 - two_pi * BROWN_HZ / (double)sample_rate);
+    // white is uniform in [-1, 1): variance 1/3; the integrator multiplies
+    // it by 1 / (1 - leak^2)
+    ns->k = (float)(NOISE_RMS * sqrt(3.0 * (1.0 - (double)ns->leak * ns->leak)));
+    // start the pink rows full, as if the generator had been running for a
+    // while; from zero the slow rows take up to 2^PINK_ROWS samples to be
+    // drawn, and the start of the file would be short of low end
+    noise_white(ns, ns->r);
+    for (int k = 0; k < PINK_ROWS; k++) {
+        ns->rows[k] = ns->r[k];
+        ns->sum += ns->rows[k];
+    }
+}
+
+// trailing zeros of v != 0 without a compiler builtin (de Bruijn sequence)
+static int ctz32(uint32_t v) {
+    static const int pos[32] = {
+        0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4, 8,
+        31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9
+    };
+    return pos[((v & (0u - v)) * 0x077CB531u) >> 27];
+}
+
+// x[i] = scale * (x[i] - x[i-1]), carrying the last sample to the next
+// block; the shifted copy in r[] keeps the loop free of a dependence
+static void noise_diff(noise_t *ns, float scale, float *restrict x) {
+    float *restrict r = ns->r;
+    r[0] = ns->prev;
+    memcpy(r + 1, x, (BLOCK_SAMPLES - 1) * sizeof *x);
+    ns->prev = x[BLOCK_SAMPLES - 1];
+    for (size_t i = 0; i < BLOCK_SAMPLES; i++) x[i] = scale * (x[i] - r[i]);
+}
+
+static void render_noise(noise_t *ns, gen_mode_t mode, float amp, float *restrict x) {
+    noise_white(ns, x);
+    switch (mode) {
+    case MODE_PINK: case MODE_BLUE: {
+        // PINK_ROWS + 1 uniform values: variance (PINK_ROWS + 1) / 3
+        const float pink = NOISE_RMS * sqrtf(3.0f / (PINK_ROWS + 1));
+        noise_white(ns, ns->r);
+        float sum = ns->sum;
+        uint32_t c = ns->counter;
+        for (size_t i = 0; i < BLOCK_SAMPLES; i++) {
+            int k = ctz32(++c | (1u << (PINK_ROWS - 1)));   // row PINK_ROWS-1 also takes the counter wrap
+            sum += ns->r[i] - ns->rows[k];
+            ns->rows[k] = ns->r[i];
+            x[i] = sum + x[i];
+        }
+        ns->sum = sum;
+        ns->counter = c;
+        if (mode == MODE_PINK) {
+            for (size_t i = 0; i < BLOCK_SAMPLES; i++) x[i] *= amp * pink;
+            break;
+        }
+        // one row and the white row change per sample: the difference has
+        // variance 2/3 + 2/3
+        noise_diff(ns, amp * NOISE_RMS * sqrtf(3.0f / 4.0f), x);
+        break;
+    }
+    case MODE_BROWN: {
+        float y = ns->y;
+        for (size_t i = 0; i < BLOCK_SAMPLES; i++) {
+            y = ns->leak * y + ns->k * x[i];
+            x[i] = amp * y;
+        }
+        ns->y = y;
+        break;
+    }
+    default:   // MODE_VIOLET: difference of two uniforms, variance 2/3
+        noise_diff(ns, amp * NOISE_RMS * sqrtf(3.0f / 2.0f), x);
+        break;
+    }
+}
+
+/*
+Integer phase accumulator (--accum 32|64, sine and chirp modes).
+
+The double phase of the sine mode is the gen~ chain in
+sine-oscillator.maxpat: accum, % twopi, sin. Its wrap subtracts an
+inexact two_pi, so rounding error builds up over long renders, and it
+costs a sin() per sample. Here the phase is an unsigned 32- or 64-bit
+integer with 2^N = one cycle: the increment is a fixed integer, "% twopi"
+is the free wrap-around of unsigned overflow, so the phase after n samples
+is exactly n * inc mod 2^N and the signal repeats bit-exactly, on any
+render length. "sin" is a SINE_LUT_SIZE table read by the top bits of the
+phase, linearly interpolated by the next 24 (error about 3e-7, -130 dB).
+
+The chirp's increment is a second accumulator that grows by a constant
+each sample. It is always kept to 64 bits; with --accum 32 the phase adds
+its top half, since (f2 - f1) / (T sr^2) * 2^32 would round to a few
+integer steps.
+*/
+#define SINE_LUT_BITS 12
+#define SINE_LUT_SIZE (1 << SINE_LUT_BITS)
+
+static float sine_lut[SINE_LUT_SIZE + 1];   // + 1 guard: [SIZE] == [0]
+
+static void sine_lut_build(void) {
+    const double two_pi = 2.0 * acos(-1.0);
+    for (int i = 0; i < SINE_LUT_SIZE; i++) sine_lut[i] = (float)sin(two_pi * i / SINE_LUT_SIZE);
+    sine_lut[SINE_LUT_SIZE] = sine_lut[0];
+}
+
+// phase is 2^64 per cycle; a 32-bit phase is passed shifted up by 32
+static inline float sine_lut_read(uint64_t phase) {
+    uint32_t i = (uint32_t)(phase >> (64 - SINE_LUT_BITS));
+    float frac = (float)(uint32_t)((phase >> (64 - SINE_LUT_BITS - 24)) & 0xFFFFFFu) * (1.0f / 16777216.0f);
+    return sine_lut[i] + frac * (sine_lut[i + 1] - sine_lut[i]);
+}
+
+// cycles per sample as a 64-bit increment (2^64 per cycle); frequencies
+// outside 0..sample_rate alias onto it, exactly as they would sound
+static uint64_t phase_inc64(double f, uint32_t sample_rate) {
+    double c = f / (double)sample_rate;
+    c -= floor(c);
+    double v = ldexp(c, 64);
+    return v >= 18446744073709551616.0 ? 0 : (uint64_t)v;
+}
+
+/*
+Envelopes (--amp-env, --freq-env), for every mode.
+
+An envelope is a list of breakpoints (time, value) joined by linear or
+exponential segments, held flat before the first point and after the
+last. "adsr:A,D,S,R" is shorthand for 0 -> 1 in A seconds, -> S in D,
+hold, -> 0 in the last R seconds of the file. Any other spec is a file
+with one breakpoint per line, "seconds value [lin|exp]", lin or exp
+being the shape of the segment that ends there (exp needs both ends
+> 0); '#' starts a comment.
+
+The amplitude envelope multiplies the output of any mode, on top of amp.
+The frequency envelope is a ratio (2 = an octave up, > 0) on f1 and f2,
+for the oscillator modes: sine, chirp, the table and blep modes and fm
+(per FM_CTRL segment there). It is not capped: above sample_rate / 2 the
+sine, table and fm modes alias (fold back) just as a high f1 does; the
+blep modes assume less than a cycle per sample and clip at or above the
+sample rate. The noise modes, impulse, silence, additive and
+expsweep ignore it; expsweep must stay the exact sweep deconvolve
+inverts.
+
+Envelopes are rendered a block at a time, not tested sample by sample:
+env_render() cuts the block where breakpoints fall and fills each piece
+with a ramp, a + d*i or a * r^i, ENV_LANES samples per step so the loop
+vectorizes. Each piece starts from an exactly computed value, so the
+running product of an exponential ramp cannot drift far.
+*/
+#define ENV_MAX_POINTS 256
+#define ENV_LANES      8
+
+typedef struct {
+    int     n;                      // breakpoints; 0 = no envelope
+    double  s[ENV_MAX_POINTS];      // positions in samples
+    float   v[ENV_MAX_POINTS];
+    uint8_t expo[ENV_MAX_POINTS];   // the segment ending at point k is exponential
+    int     k;                      // first breakpoint after the render position
+} env_t;
+
+static int env_load(env_t *e, const char *spec, double seconds, uint32_t sample_rate) {
+    memset(e, 0, sizeof *e);
+    double t[ENV_MAX_POINTS];
+    if (!strncmp(spec, "adsr:", 5)) {
+        double a, d, sus, r;
+        if (sscanf(spec + 5, "%lf,%lf,%lf,%lf", &a, &d, &sus, &r) != 4 || a < 0.0 || d < 0.0 || r < 0.0) {
+            fprintf(stderr, "envelope: use adsr:A,D,S,R with times >= 0.\n");
+            return -1;
+        }
+        // release in the last r seconds, or right after the decay if the
+        // file is too short for all of it
+        double gate = seconds - r > a + d ? seconds - r : a + d;
+        const double pt[5] = { 0.0, a, a + d, gate, gate + r };
+        const float pv[5] = { 0.0f, 1.0f, (float)sus, (float)sus, 0.0f };
+        for (int i = 0; i < 5; i++) {
+            t[i] = pt[i];
+            e->v[i] = pv[i];
+        }
+        e->n = 5;
+    } else {
+        FILE *f = fopen(spec, "r");
+        if (!f) {
+            perror(spec);
+            return -1;
+        }
+        char line[256];
+        while (fgets(line, sizeof line, f)) {
+            char *hash = strchr(line, '#');
+            if (hash) *hash = '\0';
+            double tt, vv;
+            char shape[8] = "lin";
+            int got = sscanf(line, "%lf %lf %7s", &tt, &vv, shape);
+            if (got <= 0) continue;
+            int expo = !strcmp(shape, "exp");
+            if (got < 2 || (!expo && strcmp(shape, "lin")) || e->n == ENV_MAX_POINTS) {
+                fprintf(stderr, "envelope %s: bad line, or more than %d points.\n", spec, ENV_MAX_POINTS);
+                fclose(f);
+                return -1;
+            }
+            t[e->n] = tt;
+            e->v[e->n] = (float)vv;
+            e->expo[e->n] = (uint8_t)expo;
+            e->n++;
+        }
+        fclose(f);
+        if (e->n == 0) {
+            fprintf(stderr, "envelope %s: no points.\n", spec);
+            return -1;
+        }
+    }
+    for (int i = 0; i < e->n; i++) {
+        if (t[i] < 0.0 || (i > 0 && t[i] < t[i - 1])) {
+            fprintf(stderr, "envelope: times must be >= 0 and in order.\n");
+            return -1;
+        }
+        if (i > 0 && e->expo[i] && !(e->v[i - 1] > 0.0f && e->v[i] > 0.0f)) {
+            fprintf(stderr, "envelope: an exp segment needs values > 0 at both ends.\n");
+            return -1;
+        }
+        e->s[i] = t[i] * (double)sample_rate;
+    }
+    return 0;
+}
+
+// out[0..count) = a + d*i, or a * d^i if expo
+static void env_ramp(float *restrict out, size_t count, float a, float d, int expo) {
+    size_t j = 0;
+    if (!expo) {
+        float base = 0.0f;
+        for (; j + ENV_LANES <= count; j += ENV_LANES, base += (float)ENV_LANES) {
+            for (int l = 0; l < ENV_LANES; l++) out[j + l] = a + d * (base + (float)l);
+        }
+        for (; j < count; j++) out[j] = a + d * (float)j;
+        return;
+    }
+    float v[ENV_LANES], step = d;
+    v[0] = a;
+    for (int l = 1; l < ENV_LANES; l++) {
+        v[l] = v[l - 1] * d;
+        step *= d;
+    }
+    for (; j + ENV_LANES <= count; j += ENV_LANES) {
+        for (int l = 0; l < ENV_LANES; l++) {
+            out[j + l] = v[l];
+            v[l] *= step;
+        }
+    }
+    for (int l = 0; j < count; j++, l++) out[j] = v[l];
+}
+
+// the envelope for samples n0 .. n0+BLOCK_SAMPLES-1; returns its largest value
+static float env_render(env_t *e, uint64_t n0, float *out) {
+    float top = -INFINITY;
+    size_t i = 0;
+    while (i < BLOCK_SAMPLES) {
+        const double pos = (double)(n0 + i);
+        while (e->k < e->n && e->s[e->k] <= pos) e->k++;
+        const int k = e->k;
+        float a, d = 0.0f, last;
+        int expo = 0;
+        double end;                 // the piece runs up to (not including) this sample
+        if (k == 0 || k == e->n) {
+            a = last = e->v[k == 0 ? 0 : e->n - 1];
+            end = k == 0 ? ceil(e->s[0]) : (double)(n0 + BLOCK_SAMPLES);
+        } else {
+            const double s0 = e->s[k - 1], s1 = e->s[k], u = (pos - s0) / (s1 - s0);
+            const double v0 = e->v[k - 1], v1 = e->v[k];
+            expo = e->expo[k];
+            if (expo) {
+                a = (float)(v0 * pow(v1 / v0, u));
+                d = (float)pow(v1 / v0, 1.0 / (s1 - s0));
+            } else {
+                a = (float)(v0 + (v1 - v0) * u);
+                d = (float)((v1 - v0) / (s1 - s0));
+            }
+            last = (float)v1;       // bounds the piece from above, with a
+            end = ceil(s1);
+        }
+        size_t stop = end - (double)n0 < (double)BLOCK_SAMPLES ? (size_t)(end - (double)n0) : BLOCK_SAMPLES;
+        env_ramp(out + i, stop - i, a, d, expo);
+        top = a > top ? a : top;
+        top = last > top ? last : top;
+        i = stop;
+    }
+    return top;
+}
+
+// everything the render loop carries from one block to the next
+typedef struct {
+    gen_mode_t mode;
+    uint32_t   sample_rate;
+    double     seconds, f1, f2, amp;
+    uint64_t   n;               // index of the first sample of the next block
+    // set phase STATE, not a constant. Use double, not float.
+    // this will reduce long-term drift. This is for the internal oscillator
+    // state, which must be kept precise, as phase accumulates over many
+    // samples.
+    double     phase;
+    int        accum;           // 0: double phase; 32 or 64: integer (sine, chirp)
+    uint64_t   iphase, iinc;    // integer phase and increment, 2^N per cycle
+    uint64_t   dinc;            // chirp: increment change per sample (two's complement)
+    const wt_bank_t *bank;      // saw, square, triangle, wavetable
+    int        cubic;
+    blep_t     blep;            // blep modes
+    add_t     *add;             // additive
+    fm_t      *fm;              // fm
+    noise_t    noise;           // pink, brown, blue, violet
+    env_t      aenv, fenv;      // --amp-env, --freq-env
+    float      amul[BLOCK_SAMPLES];
+    float      fmul[BLOCK_SAMPLES];    // frequency ratio per sample; all 1 without --freq-env
+    float      fmul_max;        // largest fmul in the block
+} gen_t;
+
+static void render_fm(gen_t *g, float *x) {
+    fm_t *fm = g->fm;
+    const double sr = (double)g->sample_rate;
+    const double slope = (g->f2 - g->f1) / (g->seconds * sr);
+    for (size_t seg = 0; seg < BLOCK_SAMPLES; seg += FM_CTRL) {
+        double t0 = (double)(g->n + seg) / sr, t1 = (double)(g->n + seg + FM_CTRL) / sr;
+        double f = (g->f1 + slope * (double)(g->n + seg)) * g->fmul[seg];
+        float mod[FM_MAX_OPS][FM_CTRL], out[FM_CTRL];
+        float *y = x + seg;
+        memset(mod, 0, sizeof mod);
+        memset(y, 0, FM_CTRL * sizeof *y);
+        for (int k = 0; k < fm->nops; k++) {
+            int o = fm->order[k];
+            fm_op_t *op = &fm->op[o];
+            float e0 = fm_env(op, t0, fm->gate_off), e1 = fm_env(op, t1, fm->gate_off);
+            uint32_t inc = (uint32_t)(int64_t)llround(f * op->ratio / sr * 4294967296.0);
+            fm_op_segment(op, inc, mod[o], e0, (e1 - e0) / FM_CTRL, out);
+            for (int j = 0; j < fm->nops; j++) {
+                if (op->targets >> j & 1) {
+                    for (size_t i = 0; i < FM_CTRL; i++) mod[j][i] += out[i];
+                }
+            }
+            if (op->targets >> FM_OUT & 1) {
+                for (size_t i = 0; i < FM_CTRL; i++) y[i] += out[i];
+            }
+        }
+        for (size_t i = 0; i < FM_CTRL; i++) y[i] *= (float)g->amp;
+    }
+}
+
+// add BLEP_LANES voices starting at v0 into x[0..BLOCK_SAMPLES)
+static void render_blep_lanes(gen_t *g, int v0, const float *pw, float *x) {
+    blep_t *bl = &g->blep;
+    const double sr = (double)g->sample_rate;
+    const double slope = (g->f2 - g->f1) / (g->seconds * sr);
+    const float amp = (float)g->amp;
+    double ph[BLEP_LANES];
+    float ratio[BLEP_LANES], gain[BLEP_LANES];
+    memcpy(ph, bl->phase + v0, sizeof ph);
+    memcpy(ratio, bl->ratio + v0, sizeof ratio);
+    memcpy(gain, bl->gain + v0, sizeof gain);
+
+    for (size_t i = 0; i < BLOCK_SAMPLES; i++) {
+        float f = (float)((g->f1 + slope * (double)(g->n + i)) * g->fmul[i] / sr);
+        float w[BLEP_LANES], dt[BLEP_LANES], inv[BLEP_LANES], t[BLEP_LANES];
+        for (int l = 0; l < BLEP_LANES; l++) {
+            dt[l] = f * ratio[l];
+            inv[l] = 1.0f / dt[l];
+            t[l] = (float)ph[l];
+        }
+        switch (g->mode) {
+        case MODE_BLEPSAW:
+            for (int l = 0; l < BLEP_LANES; l++) {
+                w[l] = 2.0f * t[l] - 1.0f - poly_blep(t[l], dt[l], inv[l]);
+            }
+            break;
+        case MODE_BLEPSQUARE: case MODE_BLEPPULSE: {
+            // up edge at t = 0, down edge at t = width
+            const float width = pw[i];
+            for (int l = 0; l < BLEP_LANES; l++) {
+                float u = t[l] + 1.0f - width;
+                u -= 1.0f - neg_mask(u - 1.0f);
+                w[l] = 2.0f * neg_mask(t[l] - width) - 1.0f
+                     + poly_blep(t[l], dt[l], inv[l]) - poly_blep(u, dt[l], inv[l]);
+            }
+            break;
+        }
+        case MODE_BLEPTRI:
+            // slope +4 per cycle, then -4: corners of +8 at t = 0 and -8 at t = 0.5
+            for (int l = 0; l < BLEP_LANES; l++) {
+                float u = t[l] + 0.5f;
+                u -= 1.0f - neg_mask(u - 1.0f);
+                float rising = neg_mask(t[l] - 0.5f);
+                w[l] = rising * (4.0f * t[l] - 1.0f) + (1.0f - rising) * (3.0f - 4.0f * t[l])
+                     + 8.0f * poly_blamp(t[l], dt[l], inv[l]) - 8.0f * poly_blamp(u, dt[l], inv[l]);
+            }
+            break;
+        default:
+            // not a blep mode; never reached, but w must not be read uninitialized
+            memset(w, 0, sizeof w);
+            break;
+        }
+        for (int l = 0; l < BLEP_LANES; l++) {
+            w[l] *= gain[l];
+            // the same double phase accumulator as the sine mode, in cycles
+            ph[l] += (double)dt[l];
+            ph[l] -= 1.0 - neg_mask_d(ph[l] - 1.0);
+        }
+        // summed as a tree; a running sum would tie the lanes into one chain
+        x[i] += amp * (((w[0] + w[1]) + (w[2] + w[3])) + ((w[4] + w[5]) + (w[6] + w[7])));
+    }
+    memcpy(bl->phase + v0, ph, sizeof ph);
+}
+
+// --accum with a frequency envelope: the increment is scaled every sample
+// (so the phase is no longer an exact multiple of it)
+static void render_accum_env(gen_t *g, float *x) {
+    uint64_t ph = g->iphase, inc = g->iinc;
+    const int shift = 64 - g->accum;
+    for (size_t i = 0; i < BLOCK_SAMPLES; i++) {
+        x[i] = (float)g->amp * sine_lut_read(ph << shift);
+        // the scaled increment, wrapped to 0..2^64 (a frequency above the
+        // sample rate aliases, as it would sound)
+        double v = (double)inc * g->fmul[i];
+        v -= 18446744073709551616.0 * floor(v / 18446744073709551616.0);
+        ph += (v < 18446744073709551616.0 ? (uint64_t)v : 0) >> shift;
+        inc += g->dinc;
+    }
+    g->iphase = ph & (shift ? UINT32_MAX : UINT64_MAX);
+    g->iinc = inc;
+}
+
+// fill x[0..BLOCK_SAMPLES) with the next block; the caller writes as many
+// as the file still needs
+static void render_block(gen_t *g, float *x) {
+    const double two_pi = 2.0 * acos(-1.0);   // use acos(-1.0) instead of M_PI
+
+    // this block's frequency envelope; fmul stays all 1 without one
+    if (g->fenv.n) g->fmul_max = env_render(&g->fenv, g->n, g->fmul);
+
+    switch (g->mode) {
+    case MODE_SINE: {
+        if (g->accum && g->fenv.n) {
+            render_accum_env(g, x);
+            break;
+        }
+        if (g->accum == 64) {
+            // two integer adds and a table read per sample
+            for (size_t i = 0; i < BLOCK_SAMPLES; i++) {
+                x[i] = (float)g->amp * sine_lut_read(g->iphase);
+                g->iphase += g->iinc;
+            }
+            break;
+        }
+        if (g->accum == 32) {
+            uint32_t ph = (uint32_t)g->iphase, inc = (uint32_t)(g->iinc >> 32);
+            for (size_t i = 0; i < BLOCK_SAMPLES; i++) {
+                x[i] = (float)g->amp * sine_lut_read((uint64_t)ph << 32);
+                ph += inc;
+            }
+            g->iphase = ph;
+            break;
+        }
+        // force floating point division by casting sample_rate as double.
+        // inc means phase increment per sample, measured in radians.
+        // in other words, inc is radians per sample -- how far around the unit circle
+        // should the oscillator advance for each output sample?
+        // You could  write sin(two_pi * f1 * n / sample_rate) but this is better because:
+        //   it avoids repeated multiplications
+        //   it accumulates phase smoothly
+        //   generalizes easily (chirps, etc.)
+        //   it's how real oscillators work
+        double inc = two_pi * g->f1 / (double)g->sample_rate;
+        for (size_t i = 0; i < BLOCK_SAMPLES; i++) {
+            // amplitude control
+            x[i] = (float)(g->amp * sin(g->phase));
+            // phase accumulation. Advance oscillator by one sample's worth of angular rotation.
+            // (fmul is the frequency envelope, 1 without one)
+            g->phase += inc * g->fmul[i];
+            // in case phase overshot two_pi, subtract two_pi, don't set it back to 0.0!
+            // more of modulo. Don't let this grow, large floating point numbers loose resolution.
+            if (g->phase >= two_pi) g->phase -= two_pi;
+        }
+        break;
+    }
+    case MODE_NOISE: {
+        /* white noise in [-1,1) */
+        noise_white(&g->noise, x);
+        const float amp = (float)g->amp;
+        for (size_t i = 0; i < BLOCK_SAMPLES; i++) x[i] *= amp;
+        break;
+    }
+    case MODE_IMPULSE:
+        // Just the first sample is the user-defined amplitude
+        // this is followed by samples which are just 0.0 -- till the end of the WAV file.
+        memset(x, 0, BLOCK_SAMPLES * sizeof *x);
+        if (g->n == 0) x[0] = (float)g->amp;
+        break;
+    case MODE_SILENCE:
+        memset(x, 0, BLOCK_SAMPLES * sizeof *x);
+        break;
+    case MODE_CHIRP:
+        // the increment ramps linearly: an accumulator feeding an accumulator
+        if (g->accum && g->fenv.n) {
+            render_accum_env(g, x);
+            break;
+        }
+        if (g->accum == 64) {
+            for (size_t i = 0; i < BLOCK_SAMPLES; i++) {
+                x[i] = (float)g->amp * sine_lut_read(g->iphase);
+                g->iphase += g->iinc;
+                g->iinc += g->dinc;
+            }
+            break;
+        }
+        if (g->accum == 32) {
+            uint32_t ph = (uint32_t)g->iphase;
+            for (size_t i = 0; i < BLOCK_SAMPLES; i++) {
+                x[i] = (float)g->amp * sine_lut_read((uint64_t)ph << 32);
+                ph += (uint32_t)(g->iinc >> 32);
+                g->iinc += g->dinc;
+            }
+            g->iphase = ph;
+            break;
+        }
+        for (size_t i = 0; i < BLOCK_SAMPLES; i++) {
+            /* linear chirp in frequency over time: f(t) = f1 + (f2-f1)*t/T */
+            // convert sample index n to time t
+            double t = (double)(g->n + i) / (double)g->sample_rate;
+            // interpolate frequency
+            double ft = g->f1 + (g->f2 - g->f1) * (t / g->seconds);
+            // same as above in the sine wave generator...
+            double inc = two_pi * ft * g->fmul[i] / (double)g->sample_rate;
+            x[i] = (float)(g->amp * sin(g->phase));
+            // accumlate the phase as before
+            g->phase += inc;
+            // modulo two_pi
+            if (g->phase >= two_pi) g->phase -= two_pi;
+        }
+        break;
+    case MODE_EXPSWEEP: {
+        // exponential (log) sweep for impulse response measurement:
+        // f(t) = f1 * (f2/f1)^(t/T), so every octave takes the same time.
+        // The phase is its integral, 2 pi f1 L (e^(t/L) - 1) with
+        // L = T / ln(f2/f1). We evaluate it directly instead of accumulating
+        // it, so there is no drift however long the sweep is; expm1() keeps
+        // the start (t/L near 0) accurate. "wavproc01 deconvolve" turns a
+        // recording of this back into impulse responses.
+        const double L = g->seconds / log(g->f2 / g->f1);
+        for (size_t i = 0; i < BLOCK_SAMPLES; i++) {
+            double t = (double)(g->n + i) / (double)g->sample_rate;
+            x[i] = (float)(g->amp * sin(two_pi * g->f1 * L * expm1(t / L)));
+        }
+        break;
+    }
+    case MODE_SAW: case MODE_SQUARE: case MODE_TRIANGLE: case MODE_WAVETABLE: {
+        // phase in cycles here (0..1), so the table position is phase * TABLE_SIZE.
+        // with f2 the frequency glides from f1 to f2 like the chirp; the table
+        // is chosen once per block, for the highest frequency in it
+        const double sr = (double)g->sample_rate;
+        const double slope = (g->f2 - g->f1) / (g->seconds * sr);
+        double fa = (g->f1 + slope * (double)g->n) * g->fmul_max;
+        double fb = (g->f1 + slope * (double)(g->n + BLOCK_SAMPLES - 1)) * g->fmul_max;
+        const float *t = g->bank->t[wt_level(fa > fb ? fa : fb, g->sample_rate)] + 1;
+        float pos[BLOCK_SAMPLES];
+        for (size_t i = 0; i < BLOCK_SAMPLES; i++) {
+            pos[i] = (float)(g->phase * TABLE_SIZE);
+            g->phase += (g->f1 + slope * (double)(g->n + i)) * g->fmul[i] / sr;
+            if (g->phase >= 1.0) g->phase -= 1.0;
+            // still out of range only for a step of a cycle or more per
+            // sample (f >= sample_rate, which aliases); the table must
+            // never be indexed outside 0..TABLE_SIZE
+            if (g->phase >= 1.0 || g->phase < 0.0) g->phase -= floor(g->phase);
+        }
+        if (g->cubic) wt_read_cubic(t, pos, x, (float)g->amp);
+        else wt_read_linear(t, pos, x, (float)g->amp);
+        break;
+    }
+    case MODE_BLEPSAW: case MODE_BLEPSQUARE: case MODE_BLEPPULSE: case MODE_BLEPTRI: {
+        // the pulse width is shared by all voices, so it is worked out once
+        // per sample here rather than once per voice
+        float pw[BLOCK_SAMPLES];
+        blep_t *bl = &g->blep;
+        for (size_t i = 0; i < BLOCK_SAMPLES; i++) {
+            pw[i] = g->mode == MODE_BLEPPULSE
+                  ? bl->pw + bl->pwm_depth * (float)sin(two_pi * bl->lfo_phase) : 0.5f;
+            bl->lfo_phase += bl->pwm_rate / (double)g->sample_rate;
+            if (bl->lfo_phase >= 1.0) bl->lfo_phase -= 1.0;
+        }
+        memset(x, 0, BLOCK_SAMPLES * sizeof *x);
+        for (int v = 0; v < bl->voices; v += BLEP_LANES) render_blep_lanes(g, v, pw, x);
+        break;
+    }
+    case MODE_ADDITIVE:
+        if (g->add->ifft) add_render_ifft(g->add, x, (float)g->amp);
+        else add_render_osc(g->add, x, (float)g->amp);
+        break;
+    case MODE_FM:
+        render_fm(g, x);
+        break;
+    case MODE_PINK: case MODE_BROWN: case MODE_BLUE: case MODE_VIOLET:
+        render_noise(&g->noise, g->mode, (float)g->amp, x);
+        break;
+    }
+    if (g->aenv.n) {
+        env_render(&g->aenv, g->n, g->amul);
+        for (size_t i = 0; i < BLOCK_SAMPLES; i++) x[i] *= g->amul[i];
+    }
+    g->n += BLOCK_SAMPLES;
+}
+
+// convert and write n samples as 16-bit little-endian, one fwrite per block
+static void write_block(FILE *f, const float *x, size_t n) {
+    uint8_t b[2 * BLOCK_SAMPLES];
+    for (size_t i = 0; i < n; i++) {
+        uint16_t v = (uint16_t)float_to_s16(x[i]);
+        b[2 * i] = (uint8_t)(v & 0xFF);
+        b[2 * i + 1] = (uint8_t)((v >> 8) & 0xFF);
+    }
+    fwrite(b, 1, 2 * n, f);
+}
+
 static void usage(const char *prog) {
     fprintf(stderr,
         "Usage:\n"
-        "  %s mode out.wav sample_rate seconds f1 amplitude [f2]\n"
-        "Modes: sine, noise, impulse, silence, chirp\n"
+        "  %s [options] mode out.wav sample_rate seconds f1 amplitude [f2]\n"
+        "  %s --manifest <file> [--threads N]\n"
+        "      one job per line, written like the line above without the program\n"
+        "      name (\"#\" comments); jobs render in parallel (default: all cores)\n"
+        "Modes: sine, noise, pink, brown, blue, violet, impulse, silence, chirp,\n"
+        "       expsweep, saw, square, triangle, wavetable, blepsaw, blepsquare,\n"
+        "       bleppulse, bleptri, additive, fm\n"
+        "Options:\n"
+        "  --interp linear|cubic   table interpolation (default cubic)\n"
+        "  --table <file>          one cycle for wavetable mode, numbers separated by\n"
+        "                          whitespace\n"
+        "  --voices N              blep modes: N detuned voices, 1..64 (default 1)\n"
+        "  --detune cents          total detune spread of the voices (default 10)\n"
+        "  --pw w                  bleppulse width, 0..1 (default 0.5)\n"
+        "  --pwm-rate Hz           bleppulse width LFO rate (default 0)\n"
+        "  --pwm-depth d           bleppulse width LFO swing, +-d (default 0)\n"
+        "  --partials <file>       additive: \"freq amp [phase]\" per line; f1 scales\n"
+        "                          the frequencies (1 for Hz, or the fundamental)\n"
+        "  --additive osc|ifft     additive engine (default: ifft from 64 partials)\n"
+        "  --accum 32|64           sine, chirp: integer phase and sine table instead of\n"
+        "                          a double phase and sin()\n"
+        "  --amp-env <env>         amplitude envelope, any mode\n"
+        "  --freq-env <env>        frequency ratio envelope (> 0), oscillator modes\n"
+        "                          <env> is adsr:A,D,S,R or a file of lines\n"
+        "                          \"seconds value [lin|exp]\"\n"
+        "  --fm <file>             fm patch, one operator per line:\n"
+        "                          ratio level attack decay sustain release targets [fb]\n"
+        "                          targets: operator numbers (from 1) and/or out\n"
+        "The table and blep modes glide from f1 to f2 when f2 is given.\n"
         "Examples:\n"
         "  %s sine out.wav 44100 2.0 440 0.8\n"
         "  %s noise out.wav 48000 3.0 0 0.4\n"
-        "  %s chirp out.wav 44100 3.0 200 0.8 2000\n",
-        prog, prog, prog, prog
+        "  %s pink out.wav 48000 3600 0 1.0\n"
+        "  %s chirp out.wav 44100 3.0 200 0.8 2000\n"
+        "  %s expsweep sweep.wav 48000 10.0 20 0.5 20000\n"
+        "  %s saw out.wav 48000 2.0 110 0.5\n"
+        "  %s --table cycle.txt wavetable out.wav 48000 2.0 220 0.5\n"
+        "  %s --voices 64 --detune 30 blepsaw out.wav 48000 5.0 110 0.3\n"
+        "  %s --partials organ.txt additive out.wav 48000 5.0 110 0.3\n"
+        "  %s --fm epiano.txt fm out.wav 48000 3.0 220 0.5\n"
+        "  %s --amp-env adsr:0.01,0.2,0.6,0.5 saw out.wav 48000 2.0 220 0.5\n"
+        "  %s --manifest jobs.txt --threads 8\n",
+        prog, prog, prog, prog, prog, prog, prog, prog, prog, prog, prog, prog, prog, prog
     );
 }
 
+/*
+Jobs and the manifest.
+
+A job is one output file. job_parse() takes a command line (options, mode,
+out.wav, rate, seconds, f1, amplitude [f2]), checks it and loads everything
+it names -- tables, partials, fm patch, envelopes -- and job_render() writes
+the file. A normal run is one job.
+
+--manifest <file> reads one job per line, written exactly like the command
+line without the program name ("#" starts a comment, blank lines are
+skipped). Every line is parsed first, so a typo on line 90 stops the run
+before anything is written, then the jobs are rendered on a small thread
+pool. For a folder of short test files most of the time per file is not
+the samples: it is process start-up and table setup (a saw bank is 128
+FFTs). So the built-in saw/square/triangle banks and the sine table are
+built once, on the main thread, and only read by the jobs; each job keeps
+its own gen_t and noise seed (rand() is only called while parsing), so
+rendering needs no locks. Parsing stays on the main thread because
+fm_load() uses strtok() and wt_series_file() static buffers.
+*/
+typedef struct {
+    char      *line;            // manifest: the line the argv points into
+    gen_mode_t mode;
+    const char *outpath;
+    uint32_t   sample_rate, num_samples;
+    double     seconds, f1, f2, amp;
+    int        cubic, accum, voices;
+    double     detune, pw, pwm_rate, pwm_depth;
+    uint32_t   seed;            // noise modes, drawn from rand() in job_parse()
+    const wt_bank_t *bank;      // a shared built-in bank, or own_bank
+    wt_bank_t *own_bank;        // wavetable mode: built from --table
+    add_t     *add;
+    fm_t      *fm;
+    env_t     *aenv, *fenv;     // NULL without --amp-env / --freq-env
+} job_t;
+
+// saw, square, triangle: built on first use, then shared by every job
+static wt_bank_t builtin_bank[MODE_TRIANGLE - MODE_SAW + 1];
+static int builtin_built[MODE_TRIANGLE - MODE_SAW + 1];
+static int sine_lut_built;
+
+static void job_free(job_t *j) {
+    if (j->own_bank) {
+        wt_free(j->own_bank);
+        free(j->own_bank);
+    }
+    if (j->add) {
+        add_free(j->add);
+        free(j->add);
+    }
+    free(j->fm);
+    free(j->aenv);
+    free(j->fenv);
+    free(j->line);
+    memset(j, 0, sizeof *j);
+}
+
 // similiar to public static void main(String[] args) { ... }
 // argc = number of valid entries in argv. Here, 7:
 // argv is an array of null-terminated strings
 // argv[0] = "./wavgen"
 // argv[1] = "sine"...
 // argv[i] = always a string
+//
+// main() hands its arguments to job_parse(); a manifest line is split into
+// the same shape (argv[0] is the program name there too). The job keeps
+// pointers into argv, so the strings must outlive it.
+static int job_parse(job_t *j, int argc, char **argv, const char *prog) {
+    int cubic = 1;
+    const char *table_path = NULL;
+    int voices = 1;
+    double detune = 10.0, pw = 0.5, pwm_rate = 0.0, pwm_depth = 0.0;
+    const char *partials_path = NULL;
+    const char *fm_path = NULL;
+    int accum = 0;
+    const char *amp_env_path = NULL, *freq_env_path = NULL;
+    int additive_ifft = -1;     // -1: decide from the partial count
+
+    // leading --options; after them argv[1] is the mode, as before
+    int argi = 1;
+    while (argi < argc && strncmp(argv[argi], "--", 2) == 0) {
+        if (!strcmp(argv[argi], "--interp") && argi + 1 < argc) {
+            if (!strcmp(argv[argi + 1], "linear")) cubic = 0;
+            else if (!strcmp(argv[argi + 1], "cubic")) cubic = 1;
+            else {
+                fprintf(stderr, "--interp must be linear or cubic.\n");
+                return 1;
+            }
+            argi += 2;
+        } else if (!strcmp(argv[argi], "--table") && argi + 1 < argc) {
+            table_path = argv[argi + 1];
+            argi += 2;
+        } else if (!strcmp(argv[argi], "--partials") && argi + 1 < argc) {
+            partials_path = argv[argi + 1];
+            argi += 2;
+        } else if (!strcmp(argv[argi], "--fm") && argi + 1 < argc) {
+            fm_path = argv[argi + 1];
+            argi += 2;
+        } else if (!strcmp(argv[argi], "--amp-env") && argi + 1 < argc) {
+            amp_env_path = argv[argi + 1];
+            argi += 2;
+        } else if (!strcmp(argv[argi], "--freq-env") && argi + 1 < argc) {
+            freq_env_path = argv[argi + 1];
+            argi += 2;
+        } else if (!strcmp(argv[argi], "--accum") && argi + 1 < argc) {
+            accum = (int)strtol(argv[argi + 1], NULL, 10);
+            if (accum != 32 && accum != 64) {
+                fprintf(stderr, "--accum must be 32 or 64.\n");
+                return 1;
+            }
+            argi += 2;
+        } else if (!strcmp(argv[argi], "--additive") && argi + 1 < argc) {
+            if (!strcmp(argv[argi + 1], "osc")) additive_ifft = 0;
+            else if (!strcmp(argv[argi + 1], "ifft")) additive_ifft = 1;
+            else {
+                fprintf(stderr, "--additive must be osc or ifft.\n");
+                return 1;
+            }
+            argi += 2;
+        } else if (!strcmp(argv[argi], "--voices") && argi + 1 < argc) {
+            voices = (int)strtol(argv[argi + 1], NULL, 10);
+            argi += 2;
+        } else if (!strcmp(argv[argi], "--detune") && argi + 1 < argc) {
+            detune = strtod(argv[argi + 1], NULL);
+            argi += 2;
+        } else if (!strcmp(argv[argi], "--pw") && argi + 1 < argc) {
+            pw = strtod(argv[argi + 1], NULL);
+            argi += 2;
+        } else if (!strcmp(argv[argi], "--pwm-rate") && argi + 1 < argc) {
+            pwm_rate = strtod(argv[argi + 1], NULL);
+            argi += 2;
+        } else if (!strcmp(argv[argi], "--pwm-depth") && argi + 1 < argc) {
+            pwm_depth = strtod(argv[argi + 1], NULL);
+            argi += 2;
+        } else {
+            usage(prog);
+            return 1;
+        }
+    }
+    argv += argi - 1;
+    argc -= argi - 1;
 
-int main(int argc, char **argv) {
   // "defensive" programming...
   if (argc < 7) {
-        usage(argv[0]);
+        usage(prog);
         return 1;
     }
 
-    const char *mode = argv[1];
     const char *outpath = argv[2];
+    // this would be if (mode.equals("chirp")) { ... } in java.
+    // "chirp" is a pointer and == compares addresses, not contents.
+    // int strcmp( const char *s1, const char *s2 ); compares two C strings.
+    // returns 0 if the strings are equal. It returns and int, not a bool.
+    // this is called "lexicographic comparison".
+    // switch (mode) { ... } only works with ints, enums, characters, so the
+    // name is turned into a gen_mode_t here, once, and the render loop
+    // switches on that.
+    int found = 0;
+    gen_mode_t mode = MODE_SINE;
+    for (size_t i = 0; i < sizeof mode_names / sizeof mode_names[0]; i++) {
+        if (!strcmp(argv[1], mode_names[i].name)) {
+            mode = mode_names[i].mode;
+            found = 1;
+        }
+    }
+    if (!found) {
+        fprintf(stderr, "Unknown mode: %s\n", argv[1]);
+        return 1;
+    }
     // convert sample rate to an unsigned long number, NULL termination, base 10
     // int can vary in size across platforms so we use uint32_t to be explicit
     // strtoul() returns an unsigned long, we need to cast as uint32_t.
@@ -179,34 +1885,33 @@ int main(int argc, char **argv) {
     // f1 = start frequency (Hz).
     double f1 = strtod(argv[5], NULL);
     double amp = strtod(argv[6], NULL);
-    // f2 = end frequency (Hz). This is only used  in chirp mode and
-    // is initialized here so the variable isn't left undefind. If we
-    // want to be in chirp mode, the user-inputted parameter gets
-    // assigned to f2 in the chirp() function.
-    double f2 = 0.0;
+    // f2 = end frequency (Hz). Required in chirp mode; the table modes
+    // glide to it when it is given and otherwise hold f1.
+    double f2 = argc >= 8 ? strtod(argv[7], NULL) : f1;
 
     if (sample_rate < 8000 || sample_rate > 192000 || seconds <= 0.0) {
         fprintf(stderr, "Invalid sample_rate or seconds.\n");
         return 1;
     }
 
-    // this would be if (mode.equals("chirp)) { ... } in java.
-    // "chirp" is a pointer and == compares addresses, not contents.
-    // int strcmp( const char *s1, const char *s2 ); compares two C strings.
-    // returns 0 if the strings are equal. It returns and int, not a bool.
-    // this is called "lexicographic comparison".
-    // this is the standard way to branch in string values!
-    // switch (mode) { ... } only works with ints, enums, characters.
-    if (!strcmp(mode, "chirp")) {
+    if (mode == MODE_CHIRP || mode == MODE_EXPSWEEP) {
         if (argc < 8) {
-            fprintf(stderr, "chirp mode requires f2.\n");
+            fprintf(stderr, "%s mode requires f2.\n", argv[1]);
             return 1;
         }
-        f2 = strtod(argv[7], NULL);
         if (f1 <= 0.0 || f2 <= 0.0) {
-            fprintf(stderr, "chirp frequencies must be > 0.\n");
+            fprintf(stderr, "%s frequencies must be > 0.\n", argv[1]);
             return 1;
         }
+        if (mode == MODE_EXPSWEEP && f1 == f2) {
+            fprintf(stderr, "expsweep needs f2 != f1.\n");
+            return 1;
+        }
+    }
+
+    if (voices < 1 || voices > MAX_VOICES) {
+        fprintf(stderr, "--voices must be 1..%d.\n", MAX_VOICES);
+        return 1;
     }
 
     // we round to a long long number. Need a integer number of samples.
@@ -220,9 +1925,123 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    FILE *f = fopen(outpath, "wb");
+    *j = (job_t){
+        .line = j->line, .mode = mode, .outpath = outpath,
+        .sample_rate = sample_rate, .num_samples = num_samples,
+        .seconds = seconds, .f1 = f1, .f2 = f2, .amp = amp,
+        .cubic = cubic, .accum = accum, .voices = voices, .detune = detune,
+        .pw = pw, .pwm_rate = pwm_rate, .pwm_depth = pwm_depth,
+        // rand() is only ever called here, on the main thread
+        .seed = (uint32_t)rand() ^ ((uint32_t)rand() << 16),
+    };
+
+    // build the bank once, before any samples are rendered
+    if (mode == MODE_SAW || mode == MODE_SQUARE || mode == MODE_TRIANGLE || mode == MODE_WAVETABLE) {
+        if (f1 <= 0.0 || f2 <= 0.0) {
+            fprintf(stderr, "frequencies must be > 0.\n");
+            return 1;
+        }
+        static double a[MAX_HARMONIC + 1], b[MAX_HARMONIC + 1];
+        if (mode == MODE_WAVETABLE) {
+            if (!table_path) {
+                fprintf(stderr, "wavetable mode requires --table <file>.\n");
+                return 1;
+            }
+            if (wt_series_file(table_path, a, b) != 0) return 1;
+            j->own_bank = calloc(1, sizeof *j->own_bank);
+            if (!j->own_bank || wt_build(j->own_bank, a, b) != 0) {
+                fprintf(stderr, "out of memory\n");
+                return 1;
+            }
+            j->bank = j->own_bank;
+        } else {
+            int k = mode - MODE_SAW;
+            if (!builtin_built[k]) {
+                wt_series(mode, a, b);
+                if (wt_build(&builtin_bank[k], a, b) != 0) {
+                    fprintf(stderr, "out of memory\n");
+                    return 1;
+                }
+                builtin_built[k] = 1;
+            }
+            j->bank = &builtin_bank[k];
+        }
+    }
+
+    if (mode >= MODE_BLEPSAW && mode <= MODE_BLEPTRI) {
+        if (f1 <= 0.0 || f2 <= 0.0) {
+            fprintf(stderr, "frequencies must be > 0.\n");
+            return 1;
+        }
+        if (pw - fabs(pwm_depth) <= 0.0 || pw + fabs(pwm_depth) >= 1.0 || pwm_rate < 0.0) {
+            fprintf(stderr, "pulse width must stay inside 0..1 (--pw +- --pwm-depth).\n");
+            return 1;
+        }
+    }
+
+    if (mode == MODE_ADDITIVE) {
+        if (!partials_path) {
+            fprintf(stderr, "additive mode requires --partials <file>.\n");
+            return 1;
+        }
+        if (f1 <= 0.0) {
+            fprintf(stderr, "additive: f1 (frequency scale) must be > 0.\n");
+            return 1;
+        }
+        j->add = calloc(1, sizeof *j->add);
+        if (!j->add || add_load(j->add, partials_path, f1, sample_rate, additive_ifft) != 0) {
+            fprintf(stderr, "additive: setup failed.\n");
+            return 1;
+        }
+    }
+
+    if (mode == MODE_FM) {
+        if (!fm_path) {
+            fprintf(stderr, "fm mode requires --fm <patch file>.\n");
+            return 1;
+        }
+        if (f1 <= 0.0 || f2 <= 0.0) {
+            fprintf(stderr, "frequencies must be > 0.\n");
+            return 1;
+        }
+        j->fm = calloc(1, sizeof *j->fm);
+        if (!j->fm) {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+        if (fm_load(j->fm, fm_path, seconds) != 0) return 1;
+    }
+
+    // envelopes are parsed before the output file is created
+    if (amp_env_path) {
+        j->aenv = calloc(1, sizeof *j->aenv);
+        if (!j->aenv || env_load(j->aenv, amp_env_path, seconds, sample_rate) != 0) return 1;
+    }
+    if (freq_env_path) {
+        j->fenv = calloc(1, sizeof *j->fenv);
+        if (!j->fenv || env_load(j->fenv, freq_env_path, seconds, sample_rate) != 0) return 1;
+        // a ratio of 0 or less would stop the oscillator or run it backwards
+        for (int i = 0; i < j->fenv->n; i++) {
+            if (!(j->fenv->v[i] > 0.0f)) {
+                fprintf(stderr, "--freq-env values are frequency ratios and must be > 0"
+                                " (adsr: starts and ends at 0; use a file).\n");
+                return 1;
+            }
+        }
+    }
+
+    if (accum && (mode == MODE_SINE || mode == MODE_CHIRP) && !sine_lut_built) {
+        sine_lut_build();
+        sine_lut_built = 1;
+    }
+    return 0;
+}
+
+// render one parsed job to its file; safe to run on several threads at once
+static int job_render(const job_t *j) {
+    FILE *f = fopen(j->outpath, "wb");
     if (!f) {
-        perror("fopen");
+        perror(j->outpath);
         return 1;
     }
 
@@ -244,86 +2063,239 @@ int main(int argc, char **argv) {
     // the fourCCs (RIFF, WAVE, fmt, data) are written as ASCII. RIFF
     // stands for Resource Interchange File Format...
     // Raw PCM has no metadata, isn't self-describing.
-    write_wav_header(f, sample_rate, num_samples);
+    write_wav_header(f, j->sample_rate, j->num_samples);
+
+    // the render state is a few hundred KB (blep voices, envelopes), too
+    // big for a worker thread's stack
+    gen_t *g = calloc(1, sizeof *g);
+    if (!g) {
+        fprintf(stderr, "out of memory\n");
+        fclose(f);
+        return 1;
+    }
+    g->mode = j->mode;
+    g->sample_rate = j->sample_rate;
+    g->seconds = j->seconds;
+    g->f1 = j->f1;
+    g->f2 = j->f2;
+    g->amp = j->amp;
+    g->bank = j->bank;
+    g->cubic = j->cubic;
+    blep_init(&g->blep, j->voices, j->detune, j->pw, j->pwm_rate, j->pwm_depth);
+    noise_init(&g->noise, j->sample_rate, j->seed);
+    if (j->aenv) g->aenv = *j->aenv;
+    if (j->fenv) g->fenv = *j->fenv;
+    for (size_t i = 0; i < BLOCK_SAMPLES; i++) g->fmul[i] = 1.0f;
+    g->fmul_max = 1.0f;
+    if (j->accum && (j->mode == MODE_SINE || j->mode == MODE_CHIRP)) {
+        g->accum = j->accum;
+        g->iinc = phase_inc64(j->f1, j->sample_rate);
+        // (f2 - f1) / seconds Hz per second, per sample, in increment units
+        double d = ldexp((j->f2 - j->f1) / (j->seconds * (double)j->sample_rate)
+                         / (double)j->sample_rate, 64);
+        g->dinc = j->mode == MODE_CHIRP ? (uint64_t)(int64_t)llround(d) : 0;
+    }
+    g->add = j->add;
+    g->fm = j->fm;
+    // again, "defensive" coding -- the block is fully written by every mode,
+    // but start it zeroed anyway
+    float x[BLOCK_SAMPLES] = { 0 };
+    for (uint32_t done = 0; done < j->num_samples; ) {
+        uint32_t n = j->num_samples - done < BLOCK_SAMPLES ? j->num_samples - done : BLOCK_SAMPLES;
+        render_block(g, x);
+        write_block(f, x, n);
+        done += n;
+    }
+
+    free(g);
+    int err = ferror(f);
+    if (fclose(f) != 0 || err) {
+        fprintf(stderr, "%s: write failed\n", j->outpath);
+        return 1;
+    }
+    return 0;
+}
+
+#define MANIFEST_MAX_ARGS 64
+
+typedef struct {
+    job_t          *jobs;
+    size_t          njobs, next;
+    pthread_mutex_t lock;
+    int             failed;
+} pool_t;
+
+// each worker takes the next unrendered job until none are left
+static void *job_worker(void *arg) {
+    pool_t *p = arg;
+    for (;;) {
+        pthread_mutex_lock(&p->lock);
+        size_t i = p->next++;
+        pthread_mutex_unlock(&p->lock);
+        if (i >= p->njobs) break;
+        if (job_render(&p->jobs[i]) != 0) {
+            pthread_mutex_lock(&p->lock);
+            p->failed = 1;
+            pthread_mutex_unlock(&p->lock);
+        }
+    }
+    return NULL;
+}
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+static int run_manifest(const char *prog, const char *path, long threads) {
+    FILE *mf = fopen(path, "r");
+    if (!mf) {
+        perror(path);
+        return 1;
+    }
+    job_t *jobs = NULL;
+    size_t njobs = 0, cap = 0;
+    char buf[4096];
+    int lineno = 0, bad = 0;
+    while (!bad && fgets(buf, sizeof buf, mf)) {
+        lineno++;
+        // no newline and more to come: the rest would be read as another job
+        if (!strchr(buf, '\n')) {
+            int c = fgetc(mf);
+            if (c != EOF) {
+                fprintf(stderr, "%s:%d: line too long (max %zu characters)\n",
+                        path, lineno, sizeof buf - 2);
+                bad = 1;
+                break;
+            }
+        }
+        char *hash = strchr(buf, '#');
+        if (hash) *hash = '\0';
+        char *line = strdup(buf);
+        if (!line) {
+            fprintf(stderr, "out of memory\n");
+            bad = 1;
+            break;
+        }
+        // split on whitespace in place; argv[0] stands in for the program
+        char *argv[MANIFEST_MAX_ARGS + 1];
+        int argc = 0;
+        argv[argc++] = (char *)prog;
+        for (char *s = line; *s; ) {
+            while (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n') *s++ = '\0';
+            if (!*s) break;
+            if (argc == MANIFEST_MAX_ARGS) {
+                fprintf(stderr, "%s:%d: too many arguments\n", path, lineno);
+                bad = 1;
+                break;
+            }
+            argv[argc++] = s;
+            while (*s && *s != ' ' && *s != '\t' && *s != '\r' && *s != '\n') s++;
+        }
+        if (bad || argc == 1) {
+            free(line);
+            continue;
+        }
+        argv[argc] = NULL;
+        if (njobs == cap) {
+            cap = cap ? 2 * cap : 64;
+            job_t *nj = realloc(jobs, cap * sizeof *jobs);
+            if (!nj) {
+                fprintf(stderr, "out of memory\n");
+                free(line);
+                bad = 1;
+                break;
+            }
+            jobs = nj;
+        }
+        job_t *j = &jobs[njobs++];
+        memset(j, 0, sizeof *j);
+        j->line = line;
+        if (job_parse(j, argc, argv, prog) != 0) {
+            fprintf(stderr, "%s:%d: bad job, nothing written\n", path, lineno);
+            bad = 1;
+            break;
+        }
+        // two threads writing one file would leave it garbled
+        for (size_t i = 0; i + 1 < njobs; i++) {
+            if (!strcmp(jobs[i].outpath, j->outpath)) {
+                fprintf(stderr, "%s:%d: %s is already written by an earlier line\n",
+                        path, lineno, j->outpath);
+                bad = 1;
+                break;
+            }
+        }
+    }
+    fclose(mf);
+    if (!bad && njobs == 0) {
+        fprintf(stderr, "%s: no jobs\n", path);
+        bad = 1;
+    }
+
+    int failed = bad;
+    if (!bad) {
+        if (threads < 1) threads = 1;
+        if ((size_t)threads > njobs) threads = (long)njobs;
+        pool_t pool = { .jobs = jobs, .njobs = njobs };
+        pthread_mutex_init(&pool.lock, NULL);
+        pthread_t *tids = calloc((size_t)threads, sizeof *tids);
+        double t0 = now_s();
+        long started = 0;
+        if (tids) {
+            for (; started < threads; started++) {
+                if (pthread_create(&tids[started], NULL, job_worker, &pool) != 0) break;
+            }
+        }
+        // no threads at all: render on this one
+        if (started == 0) job_worker(&pool);
+        for (long t = 0; t < started; t++) pthread_join(tids[t], NULL);
+        double t1 = now_s();
+        free(tids);
+        pthread_mutex_destroy(&pool.lock);
+        failed = pool.failed;
+
+        double audio = 0.0;
+        for (size_t i = 0; i < njobs; i++) audio += jobs[i].seconds;
+        fprintf(stderr, "%zu files, %.1f s of audio in %.2f s on %ld threads%s\n",
+                njobs, audio, t1 - t0, started > 0 ? started : 1,
+                failed ? " (some failed)" : "");
+    }
+
+    for (size_t i = 0; i < njobs; i++) job_free(&jobs[i]);
+    free(jobs);
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+    const char *prog = argv[0];
 
     // seeds C's pseudo-random number generator with the current time,
     // so that calls to rand() produce a different random sequence,
     // each time the program runs. Not a "high quality" noise generator!
     // --- a "stochastic" signal, as opposed to a deterministic one...
-    // call srand() only once, not multiple times!
+    // call srand() only once, not multiple times! (so here, not per job)
     srand((unsigned)time(NULL));
 
-    // set phase STATE, not a constant. Use double, not float.
-    // this will reduce long-term drift. This is for the internal oscillator
-    // state, which must be kept precise, as phase accumulates over many
-    // samples.
-    double phase = 0.0;
-    const double two_pi = 2.0 * acos(-1.0);   // use acos(-1.0) instead of M_PI
-
-
-    // this is a bit wasteful, we are doing string comparisons every time
-    // the loop iterates. We could define a typedef enum ( MODE_SINE, ... } mode_t;
-    // instead, and switch inside the loop.
-    
-    for (uint32_t n = 0; n < num_samples; n++) {
-        // again, "defensive" coding -- assign a value to a variable instead of
-        // float x;
-        float x = 0.0f;
-
-        if (!strcmp(mode, "sine")) {
-  	    // force floating point division by casting sample_rate as double.
-	    // inc means phase increment per sample, measured in radians.
-	    // in other words, inc is radians per sample -- how far around the unit circle
-	    // should the oscillator advance for each output sample?
-	    // You could  write sin(two_pi * f1 * n / sample_rate) but this is better because:
-	    //   it avoids repeated multiplications
-	    //   it accumulates phase smoothly
-	    //   generalizes easily (chirps, etc.)
-	    //   it's how real oscillators work
-	    double inc = two_pi * f1 / (double)sample_rate;
-	    // amplitude control
-            x = (float)(amp * sin(phase));
-	    // phase accumulation. Advance oscillator by one sample's worth of angular rotation.
-            phase += inc;
-	    // in case phase overshot two_pi, subtract two_pi, don't set it back to 0.0!
-	    // more of modulo. Don't let this grow, large floating point numbers loose resolution.
-            if (phase >= two_pi) phase -= two_pi;
-        } else if (!strcmp(mode, "noise")) {
-            /* white noise in [-1,1] */
-            float r = 2.0f * frand_uniform() - 1.0f;
-            x = (float)(amp * r);
-        } else if (!strcmp(mode, "impulse")) {
-	    // Just the first sample is the user-defined amplitude
-	    // this is followed by samples which are just 0.0 -- till the end of the WAV file.
-	    // if n==0, assign x the user-defined amplitude; else assign x 0.0f...
-	    x = (n == 0) ? (float)amp : 0.0f;
-        } else if (!strcmp(mode, "silence")) {
-            x = 0.0f;
-        } else if (!strcmp(mode, "chirp")) {
-            /* linear chirp in frequency over time: f(t) = f1 + (f2-f1)*t/T */
-	    // convert sample index n to time t
-	    double t = (double)n / (double)sample_rate;
-	    // seconds is defined by the user on the command line.
-	    double T = seconds;
-	    // interpolate frequency
-            double ft = f1 + (f2 - f1) * (t / T);
-	    // same as above in the sine wave generator...
-            double inc = two_pi * ft / (double)sample_rate;
-            x = (float)(amp * sin(phase));
-	    // accumlate the phase as before
-            phase += inc;
-	    // modulo two_pi
-            if (phase >= two_pi) phase -= two_pi;
-        } else {
-            fprintf(stderr, "Unknown mode: %s\n", mode);
-            fclose(f);
+    int rc;
+    if (argc >= 3 && !strcmp(argv[1], "--manifest")) {
+        long threads = sysconf(_SC_NPROCESSORS_ONLN);
+        if (argc == 5 && !strcmp(argv[3], "--threads")) {
+            threads = strtol(argv[4], NULL, 10);
+        } else if (argc != 3) {
+            usage(prog);
             return 1;
         }
-
-        int16_t s = float_to_s16(x);
-        write_u16_le(f, (uint16_t)s);
+        rc = run_manifest(prog, argv[2], threads);
+    } else {
+        job_t job = { 0 };
+        rc = job_parse(&job, argc, argv, prog);
+        if (rc == 0) rc = job_render(&job);
+        job_free(&job);
     }
 
-    fclose(f);
-    return 0;
+    for (size_t k = 0; k < sizeof builtin_bank / sizeof builtin_bank[0]; k++) {
+        if (builtin_built[k]) wt_free(&builtin_bank[k]);
+    }
+    return rc;
 }
@@ -4,23 +4,97 @@ wavproc01.c
 Simple WAV processor: gain and low-pass filter
 PCM 16-bit mono only
 
+Build:
+  gcc -O2 -Wall -Wextra -std=c11 wavproc01.c -lm -pthread -o wavproc01
+
 usage:
 
 ./wavproc01 gain in.wav out.wav 0.5
 ./wavproc01 lpf in.wav out.wav 1000
+./wavproc01 lpf in.wav out.wav @cutoff.txt
+./wavproc01 autobench lpf in.wav cutoff.txt
+./wavproc01 latency lpf in.wav 1000 256 50
+./wavproc01 gainq in.wav out.wav 0.5
+./wavproc01 lpfq in.wav out.wav 1000
+./wavproc01 compare lpf in.wav 1000
+./wavproc01 limit in.wav out.wav -1.0 5 1 50
+./wavproc01 compress in.wav out.wav -18 4 5 5 100
+./wavproc01 normalize in.wav out.wav peak -1.0
+./wavproc01 normalize in.wav out.wav rms -20
+./wavproc01 loudness in.wav
+./wavproc01 stft in.wav spec.npy 1024 256 hann db
+./wavproc01 sweep lpf in.wav out_{}.wav 250,500,1000,2000
+./wavproc01 serve /tmp/wavproc.sock 4 &
+./wavproc01 client /tmp/wavproc.sock lpf in.wav out.wav 1000
+./wavproc01 --cache /var/cache/wavproc lpf in.wav out.wav 1000
+./wavproc01 --start 3600s --end 3630s --preroll 50ms lpf in.wav out.wav 1000
+./wavproc01 trim in.wav out.wav 1.5s 10s
+./wavproc01 concat out.wav a.wav b.wav c.wav
+./wavproc01 split in.wav part_{}.wav 60s
+./wavproc01 mix out.wav drums.wav 0.8 bass.wav 0.7 vox.wav 1.0@2.5s
+./wavproc01 reverb in.wav out.wav 2.0 6000 0.3 16
+./wavproc01 stretch speech.wav slow.wav 1.25 wsola fast
+./wavproc01 pitch voice.wav up.wav 3 wsola fast
+./wavproc01 deconvolve recorded.wav sweep.wav ir.wav 500ms 5 20 20000
+
+The integer modes (gainq, lpfq) pick up pmulhrsw when built with
+-mssse3, -mavx2 or -march=native.
 
 
 */
 
+// clock_gettime(), sockets, mmap() etc. are POSIX, and copy_file_range()
+// is a GNU/Linux extension; none of them are plain C11.
+#define _GNU_SOURCE
 
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <errno.h>
+#if defined(__linux__)
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
+// number of samples moved per fread()/fwrite(). Reading one sample at a
+// time through read_u16_le() costs a library call per sample; a block of
+// a few thousand keeps everything in L1 and lets the compiler vectorize
+// the inner loops.
+#define BLOCK_SAMPLES 4096
+
+// part of every output cache key; bump it whenever a mode's output changes
+#define WAVPROC_VERSION "wavproc01-1"
+
+// in a daemon worker: the connection whose job is running, else -1
+static int job_conn = -1;
 
 // centralize fatal error handling
+// A daemon worker first tells the client why its job failed; the worker
+// process then exits like any other run would and the daemon replaces it.
 static void die(const char *msg) {
+    if (job_conn >= 0) {
+        char buf[512];
+        int len = snprintf(buf, sizeof buf, "error %s", msg);
+        if (len > 0) send(job_conn, buf, (size_t)len < sizeof buf ? (size_t)len : sizeof buf - 1, MSG_NOSIGNAL);
+    }
     fprintf(stderr, "%s\n", msg);
     exit(1);
 }
@@ -49,6 +123,14 @@ static void write_u32_le(FILE *f, uint32_t v) {
     if (fwrite(b, 1, 4, f) != 4) die("write_u32_le: fwrite failed");
 }
 
+// where the analysis modes print their results: stdout, or a buffer that
+// is sent back to the client when running inside the daemon
+static FILE *report_out = NULL;
+
+static FILE *report(void) {
+    return report_out ? report_out : stdout;
+}
+
 static uint16_t read_u16_le(FILE *f) {
     uint8_t b[2];
     // be careful, if the number of read-in bytes is not exactly 2, we might have a malformed or truncated WAV file.
@@ -77,15 +159,20 @@ static float s16_to_float(int16_t s) {
 }
 
 static int16_t float_to_s16(float x) {
+    // a NaN (gain nan, a bad automation file) would pass both clamps, and
+    // converting it to an integer is undefined behavior; make it silence
+    if (!(x == x)) x = 0.0f;
     if (x > 1.0f) x = 1.0f;
     if (x < -1.0f) x = -1.0f;
-    // long round to integer (float version). Rounds a fp number to the nearest int.
-    // returns a long int. Don't truncate, this will introduce distortion!
-    // don't round to int16_t. Go to long int first, then to int16_t.
-    long v = lrintf(x * 32767.0f);
-    if (v > 32767) v = 32767;
-    if (v < -32768) v = -32768;
-    return (int16_t)v;
+    // round to the nearest integer. Don't truncate, this will introduce distortion!
+    // lrintf() would do it, but it is a library call per sample. After the clamp
+    // |v| <= 32767, and adding then subtracting 1.5*2^23 pushes the fraction bits
+    // out of the mantissa, which rounds to nearest (ties to even, exactly like
+    // lrintf() in the default rounding mode). Don't build with -ffast-math, it
+    // would fold the add/subtract away.
+    const float magic = 12582912.0f;
+    float v = (x * 32767.0f + magic) - magic;
+    return (int16_t)(int32_t)v;
 }
 
 // wrap all the details of the WAV file into one typedef
@@ -96,8 +183,48 @@ typedef struct {
     uint16_t bits_per_sample;
     uint32_t data_bytes;
     long     data_offset;
+    uint32_t preroll;   // samples available in front of data_offset for warm-up
 } wav_info_t;
 
+/*
+--start/--end/--preroll. A position is a sample index ("48000") or a time
+("1.5s", "250ms"). read_wav_header() applies the range, so every mode
+sees a data chunk that simply starts at data_offset + start*block_align
+and is end-start samples long: they all seek straight there and never
+touch the rest of the file.
+
+That only makes sense for the modes that process one input. The ones that
+read several (concat, mix, deconvolve) would trim every input, not the
+output, and trim/split take their own positions, so run_command() refuses
+the options for those rather than quietly doing something else.
+*/
+typedef struct {
+    double v;
+    int    is_time;     // v is in seconds
+    int    set;
+} wav_pos_t;
+
+static struct {
+    wav_pos_t start, end, preroll;
+    char      spec[256];    // the options as given, for cache keys
+} range;
+
+static int parse_pos(const char *s, wav_pos_t *p) {
+    char *end;
+    p->v = strtod(s, &end);
+    p->is_time = 0;
+    if (strcmp(end, "s") == 0) p->is_time = 1;
+    else if (strcmp(end, "ms") == 0) { p->is_time = 1; p->v *= 0.001; }
+    else if (*end != '\0') return -1;
+    if (p->v < 0.0) return -1;
+    p->set = 1;
+    return 0;
+}
+
+static uint64_t pos_samples(const wav_pos_t *p, uint32_t sample_rate) {
+    return p->is_time ? (uint64_t)llround(p->v * (double)sample_rate) : (uint64_t)p->v;
+}
+
 
 
 
@@ -168,6 +295,7 @@ static wav_info_t read_wav_header(FILE *f) {
             if (info.data_offset < 0) die("ftell failed");
             /* Do not skip data now; we will stream it. */
             got_data = 1;
+            if (!got_fmt) die("data chunk before fmt chunk");
         } else {
             /* Skip unknown chunk. (Chunks are word-aligned; many files pad to even.) */
             long skip = (long)chunk_size;
@@ -176,6 +304,18 @@ static wav_info_t read_wav_header(FILE *f) {
         }
     }
 
+    if (range.start.set || range.end.set) {
+        uint64_t total = info.data_bytes / 2;
+        uint64_t a = range.start.set ? pos_samples(&range.start, info.sample_rate) : 0;
+        uint64_t b = range.end.set ? pos_samples(&range.end, info.sample_rate) : total;
+        if (b > total) b = total;
+        if (a > b) die("--start is past --end or the end of the data");
+        uint64_t pre = range.preroll.set ? pos_samples(&range.preroll, info.sample_rate) : 0;
+        info.preroll = (uint32_t)(pre < a ? pre : a);
+        info.data_offset += (long)(a * 2);
+        info.data_bytes = (uint32_t)((b - a) * 2);
+    }
+
     return info;
 }
 
@@ -203,71 +343,3852 @@ static void write_wav_header_pcm16_mono(FILE *f, uint32_t sample_rate, uint32_t
     write_u32_le(f, data_bytes);
 }
 
-static void usage(void) {
-    fprintf(stderr,
-        "Usage:\n"
-        "  wavproc gain <in.wav> <out.wav> <gain>\n"
-        "  wavproc lpf  <in.wav> <out.wav> <cutoff_hz>\n"
-        "\n"
-        "Notes: PCM 16-bit mono only.\n");
-    exit(2);
+/*
+XXH64, streaming. Used to fingerprint input data for the output cache.
+It runs at several GB/s, so folding it into the read path costs next to
+nothing compared to the DSP. Input bytes are read little-endian, so the
+hash is the same on any host (and matches the reference xxHash).
+*/
+#define XXH_P1 11400714785074694791ull
+#define XXH_P2 14029467366897019727ull
+#define XXH_P3 1609587929392839161ull
+#define XXH_P4 9650029242287828579ull
+#define XXH_P5 2870177450012600261ull
+
+typedef struct {
+    uint64_t v[4];
+    uint64_t total;
+    uint64_t seed;
+    uint8_t  mem[32];
+    size_t   memsize;
+} xxh64_t;
+
+static uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
 }
 
-int main(int argc, char **argv) {
-    if (argc < 2) usage();
+static uint64_t get_u64_le(const uint8_t *p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) v = (v << 8) | p[i];
+    return v;
+}
 
-    const char *mode = argv[1];
-    if (!(strcmp(mode, "gain") == 0 || strcmp(mode, "lpf") == 0)) usage();
-    if (argc != 5) usage();
+static uint32_t get_u32_le(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
 
-    const char *inpath  = argv[2];
-    const char *outpath = argv[3];
+static uint64_t xxh64_round(uint64_t acc, uint64_t in) {
+    acc += in * XXH_P2;
+    acc = rotl64(acc, 31);
+    return acc * XXH_P1;
+}
 
-    FILE *fin = fopen(inpath, "rb");
-    if (!fin) die("Could not open input file");
-    wav_info_t in = read_wav_header(fin);
+static uint64_t xxh64_merge(uint64_t acc, uint64_t v) {
+    acc ^= xxh64_round(0, v);
+    return acc * XXH_P1 + XXH_P4;
+}
 
-    FILE *fout = fopen(outpath, "wb");
-    if (!fout) die("Could not open output file");
+static void xxh64_reset(xxh64_t *h, uint64_t seed) {
+    memset(h, 0, sizeof *h);
+    h->seed = seed;
+    h->v[0] = seed + XXH_P1 + XXH_P2;
+    h->v[1] = seed + XXH_P2;
+    h->v[2] = seed;
+    h->v[3] = seed - XXH_P1;
+}
 
-    /* Same format out as in (PCM16 mono), same data length. */
-    write_wav_header_pcm16_mono(fout, in.sample_rate, in.data_bytes);
+static void xxh64_update(xxh64_t *h, const uint8_t *p, size_t n) {
+    h->total += n;
+    if (h->memsize + n < 32) {
+        memcpy(h->mem + h->memsize, p, n);
+        h->memsize += n;
+        return;
+    }
+    if (h->memsize > 0) {
+        size_t fill = 32 - h->memsize;
+        memcpy(h->mem + h->memsize, p, fill);
+        for (int i = 0; i < 4; i++) h->v[i] = xxh64_round(h->v[i], get_u64_le(h->mem + 8 * i));
+        p += fill;
+        n -= fill;
+        h->memsize = 0;
+    }
+    // four independent lanes per 32-byte stripe
+    uint64_t v0 = h->v[0], v1 = h->v[1], v2 = h->v[2], v3 = h->v[3];
+    while (n >= 32) {
+        v0 = xxh64_round(v0, get_u64_le(p));
+        v1 = xxh64_round(v1, get_u64_le(p + 8));
+        v2 = xxh64_round(v2, get_u64_le(p + 16));
+        v3 = xxh64_round(v3, get_u64_le(p + 24));
+        p += 32;
+        n -= 32;
+    }
+    h->v[0] = v0; h->v[1] = v1; h->v[2] = v2; h->v[3] = v3;
+    memcpy(h->mem, p, n);
+    h->memsize = n;
+}
 
-    if (fseek(fin, in.data_offset, SEEK_SET) != 0) die("fseek to data failed");
+static uint64_t xxh64_digest(const xxh64_t *h) {
+    uint64_t r;
+    if (h->total >= 32) {
+        r = rotl64(h->v[0], 1) + rotl64(h->v[1], 7) + rotl64(h->v[2], 12) + rotl64(h->v[3], 18);
+        for (int i = 0; i < 4; i++) r = xxh64_merge(r, h->v[i]);
+    } else {
+        r = h->seed + XXH_P5;
+    }
+    r += h->total;
+    const uint8_t *p = h->mem;
+    size_t n = h->memsize;
+    for (; n >= 8; p += 8, n -= 8) {
+        r ^= xxh64_round(0, get_u64_le(p));
+        r = rotl64(r, 27) * XXH_P1 + XXH_P4;
+    }
+    if (n >= 4) {
+        r ^= (uint64_t)get_u32_le(p) * XXH_P1;
+        r = rotl64(r, 23) * XXH_P2 + XXH_P3;
+        p += 4;
+        n -= 4;
+    }
+    for (; n > 0; p++, n--) {
+        r ^= (uint64_t)*p * XXH_P5;
+        r = rotl64(r, 11) * XXH_P1;
+    }
+    r ^= r >> 33;
+    r *= XXH_P2;
+    r ^= r >> 29;
+    r *= XXH_P3;
+    r ^= r >> 32;
+    return r;
+}
 
-    uint32_t total_samples = in.data_bytes / 2;
+static uint64_t xxh64(const void *p, size_t n, uint64_t seed) {
+    xxh64_t h;
+    xxh64_reset(&h, seed);
+    xxh64_update(&h, p, n);
+    return xxh64_digest(&h);
+}
 
-    if (strcmp(mode, "gain") == 0) {
-        float g = (float)strtod(argv[4], NULL);
+// when set, every byte read through read_s16_block() is hashed into it
+static xxh64_t *read_hash = NULL;
 
-        for (uint32_t n = 0; n < total_samples; n++) {
-            int16_t s = (int16_t)read_u16_le(fin); /* read as unsigned then reinterpret */
-            float x = s16_to_float(s);
-            x *= g;
-            int16_t y = float_to_s16(x);
-            write_u16_le(fout, (uint16_t)y);
+// read n 16-bit samples in one go. Same byte assembly as read_u16_le(),
+// just over a whole buffer, so the result is independent of host endianness.
+// (Full blocks take a loop with a constant trip count: gcc's -O2 cost
+// model only vectorizes those, and almost every block is a full one.)
+static void read_s16_block(FILE *f, int16_t *dst, size_t n) {
+    uint8_t b[2 * BLOCK_SAMPLES];
+    while (n > 0) {
+        size_t k = n < BLOCK_SAMPLES ? n : BLOCK_SAMPLES;
+        if (fread(b, 2, k, f) != k) die("read_s16_block: fread failed");
+        if (read_hash) xxh64_update(read_hash, b, 2 * k);
+        if (k == BLOCK_SAMPLES) {
+            for (size_t i = 0; i < BLOCK_SAMPLES; i++) {
+                dst[i] = (int16_t)(uint16_t)(b[2 * i] | ((uint16_t)b[2 * i + 1] << 8));
+            }
+        } else {
+            for (size_t i = 0; i < k; i++) {
+                dst[i] = (int16_t)(uint16_t)(b[2 * i] | ((uint16_t)b[2 * i + 1] << 8));
+            }
         }
-    } else if (strcmp(mode, "lpf") == 0) {
-        double cutoff = strtod(argv[4], NULL);
-        if (cutoff <= 0.0) die("cutoff_hz must be > 0");
+        dst += k;
+        n -= k;
+    }
+}
+
+static void write_s16_block(FILE *f, const int16_t *src, size_t n) {
+    uint8_t b[2 * BLOCK_SAMPLES];
+    while (n > 0) {
+        size_t k = n < BLOCK_SAMPLES ? n : BLOCK_SAMPLES;
+        if (k == BLOCK_SAMPLES) {
+            for (size_t i = 0; i < BLOCK_SAMPLES; i++) {
+                uint16_t v = (uint16_t)src[i];
+                b[2 * i]     = (uint8_t)(v & 0xFF);
+                b[2 * i + 1] = (uint8_t)((v >> 8) & 0xFF);
+            }
+        } else {
+            for (size_t i = 0; i < k; i++) {
+                uint16_t v = (uint16_t)src[i];
+                b[2 * i]     = (uint8_t)(v & 0xFF);
+                b[2 * i + 1] = (uint8_t)((v >> 8) & 0xFF);
+            }
+        }
+        if (fwrite(b, 2, k, f) != k) die("write_s16_block: fwrite failed");
+        src += k;
+        n -= k;
+    }
+}
+
+static void s16_to_float_block(const int16_t *src, float *dst, size_t n) {
+    for (size_t i = 0; i < n; i++) dst[i] = s16_to_float(src[i]);
+}
+
+static void float_to_s16_block(const float *src, int16_t *dst, size_t n) {
+    for (size_t i = 0; i < n; i++) dst[i] = float_to_s16(src[i]);
+}
+
+// the two kernels. Both work in place on a float block.
+static void gain_block(float *x, size_t n, float g) {
+    for (size_t i = 0; i < n; i++) x[i] *= g;
+}
+
+/* One-pole low-pass: y[n] = y[n-1] + a*(x[n] - y[n-1])
+   The state y1 is carried from block to block by the caller. */
+static float lpf_block(float *x, size_t n, float a, float y1) {
+    for (size_t i = 0; i < n; i++) {
+        y1 = y1 + a * (x[i] - y1);
+        x[i] = y1;
+    }
+    return y1;
+}
+
+// RC low-pass coefficient for a given cutoff.
+static float lpf_coef(double cutoff, uint32_t sample_rate) {
+    const double two_pi = 2.0 * acos(-1.0);
+    double dt = 1.0 / (double)sample_rate;
+    double rc = 1.0 / (two_pi * cutoff);
+    return (float)(dt / (rc + dt));
+}
+
+/*
+Integer-only path. Samples stay int16_t from fread() to fwrite().
+
+Gain is a fixed-point multiply. For |g| < 1 the gain is a Q15 number and
+each sample is (s*g + 2^14) >> 15, which is exactly what the x86 pmulhrsw
+instruction computes, 8 or 16 lanes at a time. Larger gains use a Q31
+mantissa with fewer fractional bits (shift < 31) and a 64-bit product.
+Either way the result is rounded to nearest and saturated to int16.
+
+Note: >> on a negative value is an arithmetic shift on every compiler we
+care about (gcc, clang), and the rounding below relies on it.
+*/
+typedef struct {
+    int32_t g;      // gain mantissa
+    int     shift;  // number of fractional bits in g
+} q_gain_t;
 
-        /* One-pole low-pass: y[n] = y[n-1] + a*(x[n] - y[n-1]) */
-        const double two_pi = 2.0 * acos(-1.0);
-        double dt = 1.0 / (double)in.sample_rate;
-        double rc = 1.0 / (two_pi * cutoff);
-        float a = (float)(dt / (rc + dt));
+static q_gain_t q_gain_make(double g) {
+    q_gain_t q;
+    if (fabs(g) * 32768.0 < 32767.5) {
+        // Q15, never -32768 so pmulhrsw can't overflow
+        q.shift = 15;
+        q.g = (int32_t)lrint(g * 32768.0);
+        return q;
+    }
+    // find the smallest number of integer bits that holds g
+    int e = 1;
+    while (e < 16 && fabs(g) * ldexp(1.0, 31 - e) >= 2147483647.0) e++;
+    if (fabs(g) * ldexp(1.0, 31 - e) >= 2147483647.0) die("gain too large for fixed point");
+    q.shift = 31 - e;
+    q.g = (int32_t)llrint(g * ldexp(1.0, q.shift));
+    return q;
+}
+
+static int16_t sat_s16(int64_t v) {
+    if (v > 32767) return 32767;
+    if (v < -32768) return -32768;
+    return (int16_t)v;
+}
 
-        float y1 = 0.0f;
-        for (uint32_t n = 0; n < total_samples; n++) {
-            int16_t s = (int16_t)read_u16_le(fin);
-            float x = s16_to_float(s);
-            y1 = y1 + a * (x - y1);
-            int16_t y = float_to_s16(y1);
-            write_u16_le(fout, (uint16_t)y);
+static void gain_q_block(int16_t *x, size_t n, q_gain_t g) {
+    size_t i = 0;
+    if (g.shift == 15) {
+#if defined(__AVX2__)
+        const __m256i vg = _mm256_set1_epi16((int16_t)g.g);
+        for (; i + 16 <= n; i += 16) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(x + i));
+            _mm256_storeu_si256((__m256i *)(x + i), _mm256_mulhrs_epi16(v, vg));
+        }
+#elif defined(__SSSE3__)
+        const __m128i vg = _mm_set1_epi16((int16_t)g.g);
+        for (; i + 8 <= n; i += 8) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(x + i));
+            _mm_storeu_si128((__m128i *)(x + i), _mm_mulhrs_epi16(v, vg));
         }
+#endif
+        // scalar pmulhrsw for the tail (or everything, on a plain build)
+        for (; i < n; i++) {
+            int32_t p = (int32_t)x[i] * g.g;
+            x[i] = sat_s16((p + 0x4000) >> 15);
+        }
+        return;
+    }
+    const int64_t half = (int64_t)1 << (g.shift - 1);
+    for (; i < n; i++) {
+        int64_t p = (int64_t)x[i] * g.g;
+        x[i] = sat_s16((p + half) >> g.shift);
     }
+}
 
-    fclose(fin);
-    fclose(fout);
+/*
+Q31 one-pole. The state y is the sample scaled by 2^16, i.e. a Q31 value
+in [-1, 1), and a is a Q31 coefficient. a*(x - y) needs 63 bits, which an
+int64_t holds because |x - y| < 2^32 and a < 2^31.
+
+Rounding: rather than rounding the update each sample (which leaves a dead
+band where small differences never move y, so the filter stalls short of
+the input on slow decays), the bits shifted out are saved in err and added
+back next sample ("fraction saving"). Over time nothing is lost and DC
+passes through exactly. The output is then rounded to nearest.
+*/
+typedef struct {
+    int64_t a;
+    int64_t y;
+    int64_t err;
+} q_lpf_t;
+
+static q_lpf_t q_lpf_make(float a) {
+    q_lpf_t q = {0};
+    q.a = (int64_t)llrint((double)a * 2147483648.0);
+    if (q.a > 2147483647) q.a = 2147483647;
+    return q;
+}
+
+static void lpf_q_block(int16_t *x, size_t n, q_lpf_t *st) {
+    const int64_t mask = ((int64_t)1 << 31) - 1;
+    int64_t y = st->y, err = st->err;
+    const int64_t a = st->a;
+    for (size_t i = 0; i < n; i++) {
+        int64_t xi = (int64_t)x[i] * 65536;
+        int64_t acc = a * (xi - y) + err;
+        y += acc >> 31;
+        err = acc & mask;
+        x[i] = sat_s16((y + 0x8000) >> 16);
+    }
+    st->y = y;
+    st->err = err;
+}
+
+/*
+Lookahead dynamics: peak limiter and compressor.
+
+The gain for the sample leaving the delay line is decided from the peak
+of the next `look` samples still inside it, so the gain can already be
+down when the peak arrives instead of clipping it the way float_to_s16()
+would. The peak over that window comes from a monotonic deque: it holds
+window positions whose values only decrease from front to back, so the
+front is always the maximum. Each sample is pushed once and popped at most
+once, which makes the window maximum O(1) per sample (amortized) no matter
+how long the lookahead is.
+
+Both rings are power-of-two sized so wrapping is a mask.
+*/
+typedef struct {
+    float    *delay;    // lookahead delay line
+    size_t    dmask;
+    float    *dq_val;   // monotonic deque of |x| ...
+    uint64_t *dq_pos;   // ... and the sample position of each entry
+    size_t    qmask;
+    uint64_t  head, tail;
+    uint64_t  n;        // samples pushed so far
+    size_t    look;
+
+    int   is_limit;
+    float thresh;       // limit: ceiling, compress: threshold (linear)
+    float slope;        // compress: 1/ratio - 1
+    float att, rel;     // one-pole smoothing coefficients for the gain
+    float g;
+} dyn_t;
+
+static size_t pow2_at_least(size_t n) {
+    size_t p = 1;
+    while (p < n) p <<= 1;
+    return p;
+}
+
+static float smooth_coef(double ms, uint32_t sample_rate) {
+    if (ms <= 0.0) return 0.0f;
+    return (float)exp(-1.0 / (ms * 0.001 * (double)sample_rate));
+}
+
+static void dyn_init(dyn_t *d, int is_limit, double thresh_db, double ratio,
+                     double look_ms, double att_ms, double rel_ms, uint32_t sample_rate) {
+    memset(d, 0, sizeof *d);
+    d->look = (size_t)llround(look_ms * 0.001 * (double)sample_rate);
+    size_t dsize = pow2_at_least(d->look + 1);
+    size_t qsize = pow2_at_least(d->look + 2);
+    d->delay  = calloc(dsize, sizeof *d->delay);
+    d->dq_val = calloc(qsize, sizeof *d->dq_val);
+    d->dq_pos = calloc(qsize, sizeof *d->dq_pos);
+    if (!d->delay || !d->dq_val || !d->dq_pos) die("out of memory");
+    d->dmask = dsize - 1;
+    d->qmask = qsize - 1;
+    d->is_limit = is_limit;
+    d->thresh = (float)pow(10.0, thresh_db / 20.0);
+    d->slope = is_limit ? 0.0f : (float)(1.0 / ratio - 1.0);
+    d->att = smooth_coef(att_ms, sample_rate);
+    d->rel = smooth_coef(rel_ms, sample_rate);
+    d->g = 1.0f;
+}
+
+static void dyn_free(dyn_t *d) {
+    free(d->delay);
+    free(d->dq_val);
+    free(d->dq_pos);
+}
+
+// in and out may alias. out[i] is the input from `look` samples earlier.
+static void dyn_block(dyn_t *d, const float *in, float *out, size_t count) {
+    float *delay = d->delay, *dq_val = d->dq_val;
+    uint64_t *dq_pos = d->dq_pos;
+    const size_t dmask = d->dmask, qmask = d->qmask, look = d->look;
+    uint64_t head = d->head, tail = d->tail, n = d->n;
+    float g = d->g;
+
+    for (size_t i = 0; i < count; i++, n++) {
+        float x = in[i];
+        float v = fabsf(x);
+
+        // drop everything at the back that the new value dominates ...
+        while (tail != head && dq_val[(tail - 1) & qmask] <= v) tail--;
+        dq_val[tail & qmask] = v;
+        dq_pos[tail & qmask] = n;
+        tail++;
+        // ... and the front once it slides out of the window [n-look, n]
+        if (dq_pos[head & qmask] + look < n) head++;
+        float peak = dq_val[head & qmask];
+
+        float target = 1.0f;
+        if (peak > d->thresh) {
+            target = d->is_limit ? d->thresh / peak
+                                 : powf(peak / d->thresh, d->slope);
+        }
+        float c = target < g ? d->att : d->rel;
+        g = target + (g - target) * c;
+
+        delay[n & dmask] = x;
+        float xd = delay[(n - look) & dmask];
+        float gd = g;
+        // the smoothed gain may not be all the way down yet when the peak
+        // arrives; a limiter must never let it through.
+        if (d->is_limit && fabsf(xd) * gd > d->thresh) gd = d->thresh / fabsf(xd);
+        out[i] = xd * gd;
+    }
+    d->head = head;
+    d->tail = tail;
+    d->n = n;
+    d->g = g;
+}
+
+/*
+Level analysis for normalize.
+
+Peak and sum of squares are computed on the raw int16 samples: |s| fits
+in int32 and s*s in int64, so there is no float conversion in the loop and
+the result is exact. Four independent accumulators break the dependency
+chain so the compiler can keep several vector lanes busy.
+*/
+typedef struct {
+    uint32_t peak;      // max |s|, 0..32768
+    double   sumsq;     // sum of s*s
+    uint64_t samples;
+} level_t;
+
+static void level_block(level_t *lv, const int16_t *x, size_t n) {
+    int32_t m[4] = {0, 0, 0, 0};
+    int64_t q[4] = {0, 0, 0, 0};
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        for (int k = 0; k < 4; k++) {
+            int32_t v = x[i + k];
+            int32_t av = v < 0 ? -v : v;
+            if (av > m[k]) m[k] = av;
+            q[k] += (int64_t)v * v;
+        }
+    }
+    for (; i < n; i++) {
+        int32_t v = x[i];
+        int32_t av = v < 0 ? -v : v;
+        if (av > m[0]) m[0] = av;
+        q[0] += (int64_t)v * v;
+    }
+    for (int k = 0; k < 4; k++) {
+        if ((uint32_t)m[k] > lv->peak) lv->peak = (uint32_t)m[k];
+        lv->sumsq += (double)q[k];
+    }
+    lv->samples += n;
+}
+
+/*
+Sidecar cache: <in.wav>.level next to the input, a few lines of text.
+
+The key is file size + mtime + a hash of the first and last 64 KB. Hashing
+the whole file would cost as much as the analysis we are trying to skip;
+size/mtime catch normal edits and the head/tail hash catches files that
+were replaced by a copy with a preserved mtime.
+*/
+#define LEVEL_CACHE_SPAN 65536
+
+typedef struct {
+    long long size;
+    long long mtime_s;
+    long      mtime_ns;
+    uint64_t  hash;
+} file_key_t;
+
+static int file_key(const char *path, file_key_t *k) {
+    struct stat st;
+    if (stat(path, &st) != 0) return -1;
+    k->size = (long long)st.st_size;
+    k->mtime_s = (long long)st.st_mtim.tv_sec;
+    k->mtime_ns = (long)st.st_mtim.tv_nsec;
+
+    FILE *f = fopen(path, "rb");
+    if (!f) return -1;
+    uint8_t *buf = malloc(LEVEL_CACHE_SPAN);
+    if (!buf) die("out of memory");
+    // the same xxh64 as the output cache, several times faster than a
+    // byte-at-a-time hash on the 128 KB read here
+    xxh64_t h;
+    xxh64_reset(&h, 0);
+    size_t got = fread(buf, 1, LEVEL_CACHE_SPAN, f);
+    xxh64_update(&h, buf, got);
+    if (k->size > 2 * LEVEL_CACHE_SPAN) {
+        if (fseek(f, -(long)LEVEL_CACHE_SPAN, SEEK_END) == 0) {
+            got = fread(buf, 1, LEVEL_CACHE_SPAN, f);
+            xxh64_update(&h, buf, got);
+        }
+    }
+    free(buf);
+    fclose(f);
+    k->hash = xxh64_digest(&h);
     return 0;
 }
+
+static int level_cache_load(const char *path, const file_key_t *k, level_t *lv) {
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    file_key_t c;
+    level_t l;
+    unsigned long long hash, samples;
+    int ok = fscanf(f, "wavproc-level 2\nsize %lld\nmtime %lld.%ld\nhash %llx\n"
+                       "peak %u\nsumsq %lf\nsamples %llu\n",
+                    &c.size, &c.mtime_s, &c.mtime_ns, &hash,
+                    &l.peak, &l.sumsq, &samples) == 7;
+    fclose(f);
+    if (!ok) return 0;
+    c.hash = (uint64_t)hash;
+    l.samples = (uint64_t)samples;
+    if (c.size != k->size || c.mtime_s != k->mtime_s || c.mtime_ns != k->mtime_ns ||
+        c.hash != k->hash) return 0;
+    *lv = l;
+    return 1;
+}
+
+// best effort: a read-only directory just means no caching
+static void level_cache_store(const char *path, const file_key_t *k, const level_t *lv) {
+    // a temporary per process, as in the output cache: two normalize runs
+    // (or two serve workers) on one input must not write the same file
+    char tmp[4200];
+    if (snprintf(tmp, sizeof tmp, "%s.%ld.tmp", path, (long)getpid()) >= (int)sizeof tmp) return;
+    FILE *f = fopen(tmp, "w");
+    if (!f) {
+        fprintf(stderr, "warning: could not write %s\n", path);
+        return;
+    }
+    fprintf(f, "wavproc-level 2\nsize %lld\nmtime %lld.%09ld\nhash %016llx\n"
+               "peak %u\nsumsq %.17g\nsamples %llu\n",
+            k->size, k->mtime_s, k->mtime_ns, (unsigned long long)k->hash,
+            lv->peak, lv->sumsq, (unsigned long long)lv->samples);
+    // rename() is atomic, so a concurrent reader sees the old file or the new one
+    if (fclose(f) != 0 || rename(tmp, path) != 0) {
+        remove(tmp);
+        fprintf(stderr, "warning: could not write %s\n", path);
+    }
+}
+
+/*
+EBU R128 / ITU-R BS.1770-4 loudness.
+
+One streaming pass per chunk does three things:
+  - K-weighting (a high shelf and the RLB high-pass, two biquads) and the
+    sum of squares of the result over every 100 ms sub-block,
+  - 4x oversampled true peak (polyphase windowed-sinc interpolator),
+  - plain sample peak.
+Everything else is derived from the sub-block energies alone: a 400 ms
+gating block (momentary) is 4 consecutive sub-blocks, a 3 s short-term
+window is 30. That is what makes the file splittable: each thread works
+on its own range of sub-blocks and the only thing merged afterwards is an
+array of a few numbers per second, plus the peaks.
+
+A thread starting mid-file runs the filters over a second of preroll so
+the biquad state has settled by the time its range starts.
+*/
+#define LOUD_SUBBLOCKS_PER_S 10
+#define LOUD_PREROLL_S 1
+#define TP_PHASES 4
+#define TP_TAPS 12   // taps per phase, 48 total as in BS.1770 Annex 2
+
+typedef struct {
+    double b0, b1, b2, a1, a2;
+} biquad_t;
+
+// coefficients from the BS.1770 analog prototypes, valid at any rate
+static void k_weighting(uint32_t sample_rate, biquad_t *shelf, biquad_t *hp) {
+    const double pi = acos(-1.0);
+    double fs = (double)sample_rate;
+
+    double f0 = 1681.974450955533, G = 3.999843853973347, Q = 0.7071752369554196;
+    double K = tan(pi * f0 / fs);
+    double Vh = pow(10.0, G / 20.0);
+    double Vb = pow(Vh, 0.4996667741545416);
+    double a0 = 1.0 + K / Q + K * K;
+    shelf->b0 = (Vh + Vb * K / Q + K * K) / a0;
+    shelf->b1 = 2.0 * (K * K - Vh) / a0;
+    shelf->b2 = (Vh - Vb * K / Q + K * K) / a0;
+    shelf->a1 = 2.0 * (K * K - 1.0) / a0;
+    shelf->a2 = (1.0 - K / Q + K * K) / a0;
+
+    f0 = 38.13547087602444;
+    Q = 0.5003270373238773;
+    K = tan(pi * f0 / fs);
+    a0 = 1.0 + K / Q + K * K;
+    hp->b0 = 1.0;
+    hp->b1 = -2.0;
+    hp->b2 = 1.0;
+    hp->a1 = 2.0 * (K * K - 1.0) / a0;
+    hp->a2 = (1.0 - K / Q + K * K) / a0;
+}
+
+// zeroth-order modified Bessel function, for the Kaiser window
+static double bessel_i0(double x) {
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 50; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < 1e-12 * sum) break;
+    }
+    return sum;
+}
+
+// 4x interpolator, Kaiser-windowed sinc, each phase normalized to unity DC
+static void true_peak_taps(float h[TP_PHASES][TP_TAPS]) {
+    const double pi = acos(-1.0);
+    const int len = TP_PHASES * TP_TAPS;
+    const double center = (len - 1) / 2.0;
+    const double beta = 6.0;
+    for (int p = 0; p < TP_PHASES; p++) {
+        double sum = 0.0;
+        double tmp[TP_TAPS];
+        for (int k = 0; k < TP_TAPS; k++) {
+            int m = k * TP_PHASES + p;
+            double t = (m - center) / TP_PHASES;
+            double sinc = t == 0.0 ? 1.0 : sin(pi * t) / (pi * t);
+            double r = (m - center) / center;
+            double w = bessel_i0(beta * sqrt(1.0 - r * r)) / bessel_i0(beta);
+            tmp[k] = sinc * w;
+            sum += tmp[k];
+        }
+        for (int k = 0; k < TP_TAPS; k++) h[p][k] = (float)(tmp[k] / sum);
+    }
+}
+
+typedef struct {
+    // job
+    const char *path;
+    long        data_offset;
+    uint32_t    sample_rate;
+    uint64_t    start;      // first sample read (includes preroll)
+    uint64_t    first;      // first sample measured
+    uint64_t    end;        // one past the last sample measured
+    size_t      sub;        // samples per sub-block
+    double     *energy;     // one entry per sub-block from first/sub on
+    size_t      nsub;       // number of complete sub-blocks in [first, end)
+    // results
+    float       peak;
+    float       true_peak;
+} loud_job_t;
+
+// acc[i] += c * src[i] over a whole block. A function of its own so
+// restrict can tell the compiler the two never overlap, and a fixed trip
+// count so it vectorizes even at -O2 (gcc's cheap cost model will not
+// add a scalar epilogue). Callers ignore the outputs past a short block.
+static void fir_tap(float *restrict acc, const float *restrict src, float c) {
+    for (size_t i = 0; i < BLOCK_SAMPLES; i++) acc[i] += c * src[i];
+}
+
+static void *loud_worker(void *arg) {
+    loud_job_t *job = arg;
+    biquad_t f1, f2;
+    k_weighting(job->sample_rate, &f1, &f2);
+    float h[TP_PHASES][TP_TAPS];
+    true_peak_taps(h);
+    // worst-case gain of any phase, for skipping quiet blocks
+    float tp_gain = 0.0f;
+    for (int p = 0; p < TP_PHASES; p++) {
+        float g = 0.0f;
+        for (int k = 0; k < TP_TAPS; k++) g += fabsf(h[p][k]);
+        if (g > tp_gain) tp_gain = g;
+    }
+
+    FILE *f = fopen(job->path, "rb");
+    if (!f) die("Could not open input file");
+    if (fseek(f, job->data_offset + (long)(job->start * 2), SEEK_SET) != 0) die("fseek to data failed");
+
+    int16_t ibuf[BLOCK_SAMPLES];
+    // xb keeps the last TP_TAPS-1 samples in front of the block for the FIR
+    float xb[TP_TAPS - 1 + BLOCK_SAMPLES];
+    float acc[BLOCK_SAMPLES];
+    double kw[BLOCK_SAMPLES];
+    memset(xb, 0, sizeof xb);
+
+    double s1a = 0, s1b = 0, s2a = 0, s2b = 0;  // biquad states (transposed DF II)
+    float peak = 0.0f, tpeak = 0.0f;
+    memset(job->energy, 0, job->nsub * sizeof *job->energy);
+    uint64_t pos = job->start;
+    uint64_t meas_end = job->first + (uint64_t)job->nsub * job->sub;
+
+    while (pos < job->end) {
+        uint64_t left = job->end - pos;
+        size_t n = left < BLOCK_SAMPLES ? (size_t)left : BLOCK_SAMPLES;
+        read_s16_block(f, ibuf, n);
+        float *x = xb + TP_TAPS - 1;
+        s16_to_float_block(ibuf, x, n);
+        if (n < BLOCK_SAMPLES) memset(x + n, 0, (BLOCK_SAMPLES - n) * sizeof *x);
+
+        // K-weighting. The recurrence is serial; doubles keep hours of
+        // accumulation accurate and cost next to nothing here.
+        for (size_t i = 0; i < n; i++) {
+            double v = x[i];
+            double y = f1.b0 * v + s1a;
+            s1a = f1.b1 * v - f1.a1 * y + s1b;
+            s1b = f1.b2 * v - f1.a2 * y;
+            double z = f2.b0 * y + s2a;
+            s2a = f2.b1 * y - f2.a1 * z + s2b;
+            s2b = f2.b2 * y - f2.a2 * z;
+            kw[i] = z * z;
+        }
+
+        // preroll samples only warm up the filters
+        size_t i0 = pos < job->first ? (size_t)(job->first - pos) : 0;
+        if (i0 > n) i0 = n;
+
+        // sub-block energies, split at sub-block boundaries
+        for (size_t i = i0; i < n;) {
+            uint64_t g = pos + i;
+            if (g >= meas_end) break;
+            size_t sb = (size_t)((g - job->first) / job->sub);
+            uint64_t sb_end = job->first + (uint64_t)(sb + 1) * job->sub;
+            size_t stop = sb_end - pos < n ? (size_t)(sb_end - pos) : n;
+            double e = 0.0;
+            for (size_t j = i; j < stop; j++) e += kw[j];
+            job->energy[sb] += e;
+            i = stop;
+        }
+
+        // sample peak, and the same over the FIR history for the skip test
+        float bpeak = 0.0f;
+        for (size_t i = i0; i < n; i++) {
+            float a = fabsf(x[i]);
+            if (a > peak) peak = a;
+        }
+        for (size_t i = 0; i < n + TP_TAPS - 1; i++) {
+            float a = fabsf(xb[i]);
+            if (a > bpeak) bpeak = a;
+        }
+
+        // true peak: for each phase, acc[i] = sum_k h[p][k] * x[i-k].
+        // No interpolated value can exceed bpeak * sum|h|, so once the true
+        // peak is above that the block cannot change it and is skipped.
+        if (bpeak * tp_gain > tpeak) {
+            for (int p = 0; p < TP_PHASES; p++) {
+                memset(acc, 0, sizeof acc);
+                for (int k = 0; k < TP_TAPS; k++) fir_tap(acc, x - k, h[p][k]);
+                for (size_t i = i0; i < n; i++) {
+                    float a = fabsf(acc[i]);
+                    if (a > tpeak) tpeak = a;
+                }
+            }
+        }
+        memmove(xb, xb + n, (TP_TAPS - 1) * sizeof *xb);
+        pos += n;
+    }
+    fclose(f);
+
+    job->peak = peak;
+    // the interpolated points sit between samples; the samples count too
+    job->true_peak = tpeak > peak ? tpeak : peak;
+    return NULL;
+}
+
+/*
+Gating histogram: 0.01 LU bins from -70 LUFS (the absolute gate) up.
+Each bin keeps a count and the sum of the block energies in it, so the
+relative-gate mean is exact and only the bin holding the threshold itself
+is classified to 0.01 LU. Histograms from different chunks merge by
+adding bins.
+*/
+#define GATE_MIN_LUFS (-70.0)
+#define GATE_BINS 8000
+
+typedef struct {
+    uint64_t count[GATE_BINS];
+    double   energy[GATE_BINS];
+} gate_hist_t;
+
+static double lufs(double ms) {
+    return ms > 0.0 ? -0.691 + 10.0 * log10(ms) : -INFINITY;
+}
+
+static void gate_add(gate_hist_t *h, double ms) {
+    double l = lufs(ms);
+    if (!(l >= GATE_MIN_LUFS)) return;
+    long b = (long)((l - GATE_MIN_LUFS) * 100.0);
+    if (b >= GATE_BINS) b = GATE_BINS - 1;
+    h->count[b]++;
+    h->energy[b] += ms;
+}
+
+// mean energy of everything at or above `above` LUFS, as LUFS
+static double gate_mean(const gate_hist_t *h, double above) {
+    long b0 = 0;
+    if (above > GATE_MIN_LUFS) b0 = (long)((above - GATE_MIN_LUFS) * 100.0);
+    uint64_t n = 0;
+    double e = 0.0;
+    for (long b = b0; b < GATE_BINS; b++) {
+        n += h->count[b];
+        e += h->energy[b];
+    }
+    return n ? lufs(e / (double)n) : -INFINITY;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+Real FFT.
+
+An n-point real transform is done as an n/2-point complex FFT of the
+even/odd samples packed as re/im, followed by one O(n) pass that splits
+the result into the spectrum of the real signal. The complex FFT is an
+iterative radix-2 decimation in time on split re/im arrays. Its twiddles
+are stored per stage, contiguously, so the butterfly loop reads them with
+unit stride.
+
+A plan is built once and is read-only afterwards, so any number of
+threads can share one, each with its own scratch arrays.
+*/
+typedef struct {
+    size_t    n;        // real transform size
+    size_t    m;        // n/2, size of the complex FFT underneath
+    uint32_t *rev;      // bit-reversal permutation of 0..m-1
+    float    *twr, *twi;    // stage twiddles: stage with half-size h at [h-1, 2h-1)
+    float    *rtr, *rti;    // exp(-2 pi i k/n), k = 0..m, for the real split
+} fft_plan_t;
+
+static fft_plan_t *fft_plan_new(size_t n) {
+    if (n < 4 || (n & (n - 1)) != 0) die("FFT size must be a power of two >= 4");
+    const double pi = acos(-1.0);
+    fft_plan_t *p = calloc(1, sizeof *p);
+    if (!p) die("out of memory");
+    p->n = n;
+    p->m = n / 2;
+    size_t m = p->m;
+    p->rev = malloc(m * sizeof *p->rev);
+    p->twr = malloc(m * sizeof *p->twr);
+    p->twi = malloc(m * sizeof *p->twi);
+    p->rtr = malloc((m + 1) * sizeof *p->rtr);
+    p->rti = malloc((m + 1) * sizeof *p->rti);
+    if (!p->rev || !p->twr || !p->twi || !p->rtr || !p->rti) die("out of memory");
+
+    int bits = 0;
+    while (((size_t)1 << bits) < m) bits++;
+    for (size_t i = 0; i < m; i++) {
+        uint32_t r = 0;
+        for (int b = 0; b < bits; b++) r |= (uint32_t)((i >> b) & 1) << (bits - 1 - b);
+        p->rev[i] = r;
+    }
+    for (size_t h = 1; h < m; h <<= 1) {
+        for (size_t k = 0; k < h; k++) {
+            double ang = -pi * (double)k / (double)h;
+            p->twr[h - 1 + k] = (float)cos(ang);
+            p->twi[h - 1 + k] = (float)sin(ang);
+        }
+    }
+    for (size_t k = 0; k <= m; k++) {
+        double ang = -2.0 * pi * (double)k / (double)n;
+        p->rtr[k] = (float)cos(ang);
+        p->rti[k] = (float)sin(ang);
+    }
+    return p;
+}
+
+static void fft_plan_free(fft_plan_t *p) {
+    if (!p) return;
+    free(p->rev);
+    free(p->twr);
+    free(p->twi);
+    free(p->rtr);
+    free(p->rti);
+    free(p);
+}
+
+// in-place forward complex FFT of size p->m
+static void fft_complex(const fft_plan_t *p, float *re, float *im) {
+    const size_t m = p->m;
+    for (size_t i = 0; i < m; i++) {
+        size_t r = p->rev[i];
+        if (i < r) {
+            float t = re[i]; re[i] = re[r]; re[r] = t;
+            t = im[i]; im[i] = im[r]; im[r] = t;
+        }
+    }
+    for (size_t h = 1; h < m; h <<= 1) {
+        const float *wr = p->twr + h - 1;
+        const float *wi = p->twi + h - 1;
+        for (size_t j = 0; j < m; j += 2 * h) {
+            float *ar = re + j, *ai = im + j;
+            float *br = re + j + h, *bi = im + j + h;
+            for (size_t k = 0; k < h; k++) {
+                float tr = br[k] * wr[k] - bi[k] * wi[k];
+                float ti = br[k] * wi[k] + bi[k] * wr[k];
+                br[k] = ar[k] - tr;
+                bi[k] = ai[k] - ti;
+                ar[k] += tr;
+                ai[k] += ti;
+            }
+        }
+    }
+}
+
+/* Forward real FFT of x[0..n-1] into xr/xi[0..n/2].
+   zr/zi are scratch of n/2 floats each. */
+static void fft_real(const fft_plan_t *p, const float *x, float *zr, float *zi,
+                     float *xr, float *xi) {
+    const size_t m = p->m;
+    for (size_t k = 0; k < m; k++) {
+        zr[k] = x[2 * k];
+        zi[k] = x[2 * k + 1];
+    }
+    fft_complex(p, zr, zi);
+    // Z[k] and conj(Z[m-k]) give the transforms of the even (E) and odd (O)
+    // samples; X[k] = E[k] + exp(-2 pi i k/n) O[k].
+    for (size_t k = 0; k <= m; k++) {
+        size_t a = k & (m - 1);
+        size_t b = (m - k) & (m - 1);
+        float ar = zr[a], ai = zi[a];
+        float br = zr[b], bi = -zi[b];
+        float er = 0.5f * (ar + br), ei = 0.5f * (ai + bi);
+        float orr = 0.5f * (ai - bi), oi = -0.5f * (ar - br);
+        xr[k] = er + orr * p->rtr[k] - oi * p->rti[k];
+        xi[k] = ei + orr * p->rti[k] + oi * p->rtr[k];
+    }
+}
+
+/* Inverse of fft_real(): xr/xi[0..n/2] back to x[0..n-1], scaled so that
+   the round trip is exact. zr/zi are scratch of n/2 floats each. The
+   complex inverse is the forward FFT of the conjugate, conjugated. */
+static void fft_real_inverse(const fft_plan_t *p, const float *xr, const float *xi,
+                             float *zr, float *zi, float *x) {
+    const size_t m = p->m;
+    // undo the split: E[k] = (X[k] + conj(X[m-k]))/2,
+    // O[k] = (X[k] - conj(X[m-k]))/2 * exp(+2 pi i k/n), Z[k] = E[k] + i O[k]
+    for (size_t k = 0; k < m; k++) {
+        float ar = xr[k], ai = xi[k];
+        float br = xr[m - k], bi = -xi[m - k];
+        float er = 0.5f * (ar + br), ei = 0.5f * (ai + bi);
+        float dr = 0.5f * (ar - br), di = 0.5f * (ai - bi);
+        float orr = dr * p->rtr[k] + di * p->rti[k];
+        float oi = di * p->rtr[k] - dr * p->rti[k];
+        zr[k] = er - oi;
+        zi[k] = -(ei + orr);        // conjugated for the forward FFT
+    }
+    fft_complex(p, zr, zi);
+    const float scale = 1.0f / (float)m;
+    for (size_t k = 0; k < m; k++) {
+        x[2 * k] = zr[k] * scale;
+        x[2 * k + 1] = -zi[k] * scale;
+    }
+}
+
+/*
+.npy output (NumPy format 1.0): a short text header describing a C-order
+little-endian float32 array, padded so the data starts on a 64-byte
+boundary, then the raw values. np.load(path, mmap_mode='r') maps it
+without copying.
+*/
+static size_t npy_header(uint8_t *buf, size_t cap, const char *shape) {
+    char dict[256];
+    int len = snprintf(dict, sizeof dict,
+                       "{'descr': '<f4', 'fortran_order': False, 'shape': %s, }", shape);
+    if (len < 0 || (size_t)len >= sizeof dict) die("npy header too long");
+    size_t total = 10 + (size_t)len + 1;        // magic+version+len, dict, '\n'
+    total = (total + 63) & ~(size_t)63;
+    if (total > cap) die("npy header too long");
+    size_t hlen = total - 10;
+    memcpy(buf, "\x93NUMPY\x01\x00", 8);
+    buf[8] = (uint8_t)(hlen & 0xFF);
+    buf[9] = (uint8_t)((hlen >> 8) & 0xFF);
+    memcpy(buf + 10, dict, (size_t)len);
+    memset(buf + 10 + len, ' ', total - 10 - (size_t)len - 1);
+    buf[total - 1] = '\n';
+    return total;
+}
+
+// store a float as 4 little-endian bytes, whatever the host order
+static void put_f32_le(uint8_t *b, float v) {
+    uint32_t u;
+    memcpy(&u, &v, 4);
+    b[0] = (uint8_t)(u & 0xFF);
+    b[1] = (uint8_t)((u >> 8) & 0xFF);
+    b[2] = (uint8_t)((u >> 16) & 0xFF);
+    b[3] = (uint8_t)((u >> 24) & 0xFF);
+}
+
+/*
+STFT. Frame t covers samples [t*hop, t*hop + win), zero-padded to the FFT
+size and past the end of the file. Frames are independent, so each thread
+takes a contiguous range of them: the input is mmap()ed and shared, the
+window table and FFT plan are built once and shared read-only, and every
+thread has its own FFT scratch and writes its rows straight to their
+final place in the output with pwrite().
+*/
+typedef enum { STFT_MAG, STFT_DB, STFT_MAGPHASE } stft_out_t;
+
+typedef struct {
+    const fft_plan_t *plan;
+    const float      *window;
+    size_t            win, hop;
+    const uint8_t    *pcm;        // start of the data chunk (mapped)
+    uint64_t          total;      // samples in the data chunk
+    stft_out_t        what;
+    int               fd;
+    off_t             data_start; // where frame 0 goes in the output
+    size_t            row_bytes;
+    uint64_t          f0, f1;     // frames [f0, f1) for this thread
+} stft_job_t;
+
+static void *stft_worker(void *arg) {
+    stft_job_t *job = arg;
+    const size_t n = job->plan->n, bins = n / 2 + 1;
+    float *frame = calloc(n, sizeof *frame);
+    float *zr = malloc(n / 2 * sizeof *zr), *zi = malloc(n / 2 * sizeof *zi);
+    float *xr = malloc(bins * sizeof *xr), *xi = malloc(bins * sizeof *xi);
+    // batch a few rows per pwrite()
+    const size_t rows_per_write = 16;
+    uint8_t *out = malloc(rows_per_write * job->row_bytes);
+    if (!frame || !zr || !zi || !xr || !xi || !out) die("out of memory");
+
+    size_t pending = 0;
+    uint64_t pending_first = job->f0;
+    for (uint64_t t = job->f0; t < job->f1; t++) {
+        uint64_t s0 = t * job->hop;
+        size_t avail = s0 >= job->total ? 0
+                     : (job->total - s0 < job->win ? (size_t)(job->total - s0) : job->win);
+        const uint8_t *b = job->pcm + s0 * 2;
+        for (size_t i = 0; i < avail; i++) {
+            int16_t v = (int16_t)(uint16_t)(b[2 * i] | ((uint16_t)b[2 * i + 1] << 8));
+            frame[i] = s16_to_float(v) * job->window[i];
+        }
+        // zero-pad: the tail of a short frame, and up to the FFT size
+        memset(frame + avail, 0, (n - avail) * sizeof *frame);
+
+        fft_real(job->plan, frame, zr, zi, xr, xi);
+
+        uint8_t *row = out + pending * job->row_bytes;
+        for (size_t k = 0; k < bins; k++) {
+            float mag = sqrtf(xr[k] * xr[k] + xi[k] * xi[k]);
+            if (job->what == STFT_MAG) {
+                put_f32_le(row + 4 * k, mag);
+            } else if (job->what == STFT_DB) {
+                put_f32_le(row + 4 * k, 20.0f * log10f(mag > 1e-10f ? mag : 1e-10f));
+            } else {
+                put_f32_le(row + 8 * k, mag);
+                put_f32_le(row + 8 * k + 4, atan2f(xi[k], xr[k]));
+            }
+        }
+        if (++pending == rows_per_write || t + 1 == job->f1) {
+            off_t at = job->data_start + (off_t)(pending_first * job->row_bytes);
+            size_t len = pending * job->row_bytes;
+            if (pwrite(job->fd, out, len, at) != (ssize_t)len) die("stft: pwrite failed");
+            pending_first += pending;
+            pending = 0;
+        }
+    }
+    free(frame);
+    free(zr);
+    free(zi);
+    free(xr);
+    free(xi);
+    free(out);
+    return NULL;
+}
+
+/*
+Sweep: one input, K settings of the same kernel, K outputs.
+
+The input is read and converted once per block. The K filters are then
+run side by side: lane k of an 8-wide group holds the state and
+coefficient of setting k, and the inner loop over the 8 lanes has a fixed
+trip count with no dependency between lanes, so it becomes a couple of
+vector instructions. Eight cutoffs cost about what one does. Each lane
+does exactly the arithmetic lpf_block() does, so every output matches a
+single run bit for bit.
+*/
+#define SWEEP_LANES 8
+
+typedef struct {
+    float a[SWEEP_LANES];   // gain or lpf coefficient per lane
+    float y[SWEEP_LANES];   // lpf state per lane
+} sweep_group_t;
+
+// out is interleaved: out[i*SWEEP_LANES + k] is sample i of lane k
+static void sweep_lpf_block(sweep_group_t *grp, const float *x, float *out, size_t n) {
+    float y[SWEEP_LANES], a[SWEEP_LANES];
+    memcpy(y, grp->y, sizeof y);
+    memcpy(a, grp->a, sizeof a);
+    for (size_t i = 0; i < n; i++) {
+        const float xi = x[i];
+        for (int k = 0; k < SWEEP_LANES; k++) {
+            y[k] = y[k] + a[k] * (xi - y[k]);
+            out[i * SWEEP_LANES + k] = y[k];
+        }
+    }
+    memcpy(grp->y, y, sizeof y);
+}
+
+static void sweep_gain_block(const sweep_group_t *grp, const float *x, float *out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        const float xi = x[i];
+        for (int k = 0; k < SWEEP_LANES; k++) out[i * SWEEP_LANES + k] = xi * grp->a[k];
+    }
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/*
+Log-linear latency histogram (the HdrHistogram layout).
+
+Values below HIST_SUB are counted exactly. Above that, every power of two
+is split into HIST_SUB equal sub-buckets, so the relative error of any
+reported value is at most 1/HIST_SUB (about 3%) whether it is 200 ns or
+20 ms, and the whole thing is a fixed 16 KB array -- recording is an index
+computation and an increment, no allocation, no sorting.
+*/
+#define HIST_SUB_BITS 5
+#define HIST_SUB (1u << HIST_SUB_BITS)
+#define HIST_BUCKETS (64 * HIST_SUB)
+
+typedef struct {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+    double   sum;
+} lat_hist_t;
+
+static int msb_u64(uint64_t v) {
+    int b = 0;
+    while (v >>= 1) b++;
+    return b;
+}
+
+static size_t hist_index(uint64_t v) {
+    if (v < HIST_SUB) return (size_t)v;
+    int shift = msb_u64(v) - HIST_SUB_BITS;
+    // v >> shift lands in [HIST_SUB, 2*HIST_SUB), so this is the sub-bucket
+    uint64_t sub = (v >> shift) - HIST_SUB;
+    return (size_t)(shift + 1) * HIST_SUB + (size_t)sub;
+}
+
+// highest value that maps into bucket idx (what HDR calls
+// "highest equivalent value"), so percentiles are never under-reported.
+static uint64_t hist_bucket_top(size_t idx) {
+    if (idx < HIST_SUB) return (uint64_t)idx;
+    int shift = (int)(idx / HIST_SUB) - 1;
+    uint64_t sub = (uint64_t)(idx % HIST_SUB);
+    return (((sub + HIST_SUB + 1) << shift) - 1);
+}
+
+static void hist_record(lat_hist_t *h, uint64_t v) {
+    h->counts[hist_index(v)]++;
+    h->total++;
+    h->sum += (double)v;
+    if (v > h->max) h->max = v;
+}
+
+static uint64_t hist_percentile(const lat_hist_t *h, double p) {
+    if (h->total == 0) return 0;
+    uint64_t want = (uint64_t)ceil(p / 100.0 * (double)h->total);
+    if (want == 0) want = 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= want) {
+            uint64_t top = hist_bucket_top(i);
+            return top < h->max ? top : h->max;
+        }
+    }
+    return h->max;
+}
+
+static void usage(void) {
+    if (job_conn >= 0) die("bad arguments (run wavproc without arguments for usage)");
+    fprintf(stderr,
+        "Usage:\n"
+        "  wavproc [--cache <dir>] [--start <pos>] [--end <pos>] [--preroll <pos>] <mode> ...\n"
+        "  wavproc gain <in.wav> <out.wav> <gain|@automation>\n"
+        "  wavproc lpf  <in.wav> <out.wav> <cutoff_hz|@automation>\n"
+        "  wavproc gainq <in.wav> <out.wav> <gain>\n"
+        "  wavproc lpfq  <in.wav> <out.wav> <cutoff_hz>\n"
+        "  wavproc latency <gain|lpf> <in.wav> <param> <block_samples> [deadline_pct]\n"
+        "  wavproc compare <gain|lpf> <in.wav> <param>\n"
+        "  wavproc autobench <gain|lpf> <in.wav> <automation>\n"
+        "  wavproc limit <in.wav> <out.wav> <ceiling_db> [lookahead_ms] [attack_ms] [release_ms]\n"
+        "  wavproc compress <in.wav> <out.wav> <threshold_db> <ratio> [lookahead_ms] [attack_ms] [release_ms]\n"
+        "  wavproc normalize <in.wav> <out.wav> <peak|rms> <target_dbfs>\n"
+        "  wavproc loudness <in.wav> [threads]\n"
+        "  wavproc stft <in.wav> <out.npy> <fft_size> <hop> [window[:length]] [mag|db|magphase] [threads]\n"
+        "  wavproc sweep <gain|lpf> <in.wav> <out_template> <v1,v2,...>\n"
+        "  wavproc trim <in.wav> <out.wav> <start> <end>\n"
+        "  wavproc concat <out.wav> <in1.wav> <in2.wav> ...\n"
+        "  wavproc split <in.wav> <out_template> <segment_length>\n"
+        "  wavproc mix <out.wav> <in.wav> <gain[@offset]> [<in.wav> <gain[@offset]> ...]\n"
+        "  wavproc reverb <in.wav> <out.wav> <rt60_s> [damp_hz] [wet] [lines]\n"
+        "  wavproc stretch <in.wav> <out.wav> <factor> [wsola|pv] [fast|normal|best]\n"
+        "  wavproc pitch <in.wav> <out.wav> <semitones> [wsola|pv] [fast|normal|best]\n"
+        "  wavproc deconvolve <recorded.wav> <sweep.wav> <out_ir.wav> [ir_length] [harmonics f1 f2]\n"
+        "  wavproc serve <socket> [workers]\n"
+        "  wavproc client <socket> <mode> <args...>\n"
+        "  wavproc client <socket> -        (one job per line on stdin)\n"
+        "\n"
+        "gain, lpf: @file automates the value: lines of \"<time> <value>\", time\n"
+        "  in samples or 1.5s / 250ms; gain is smoothed, cutoff glides in octaves.\n"
+        "autobench: time static, automated and naive per-sample gain/lpf.\n"
+        "gainq, lpfq: integer-only (Q15/Q31) versions of gain and lpf.\n"
+        "compare: run the float and integer paths side by side and report\n"
+        "  max error (in LSB) and SNR of the integer output.\n"
+        "limit, compress: lookahead peak dynamics. Defaults: limit 5/1/50 ms,\n"
+        "  compress 5/5/100 ms. Output is latency-compensated.\n"
+        "normalize: the level analysis is cached in <in.wav>.level, so\n"
+        "  normalizing the same file to another target skips it.\n"
+        "loudness: EBU R128 integrated, range, momentary/short-term max and\n"
+        "  true peak. Chunks are measured in parallel (default: all cores).\n"
+        "stft: window is hann (default), hamming, blackman or rect, length\n"
+        "  defaults to fft_size. Writes a float32 .npy of shape (frames, bins)\n"
+        "  or (frames, bins, 2) for magphase (magnitude, phase).\n"
+        "sweep: one output per value; {} in out_template is replaced by the\n"
+        "  value (without {}, _<value> is added before the extension).\n"
+        "trim, concat, split: copy PCM data without decoding it. Positions\n"
+        "  and lengths are samples, or times such as 1.5s or 250ms. split\n"
+        "  replaces {} in out_template with the segment number.\n"
+        "mix: sum the inputs with their gains; @offset delays an input\n"
+        "  (samples, or 1.5s / 250ms). Shorter inputs are zero-padded.\n"
+        "reverb: feedback delay network, 8 or 16 lines (default 16), damping\n"
+        "  6000 Hz, wet 0.3. The output runs rt60 seconds past the input.\n"
+        "stretch: change duration by factor (2 = twice as long) without changing\n"
+        "  pitch; wsola (default) for speech, pv (phase vocoder) for music.\n"
+        "pitch: shift by semitones (-24..24) keeping the duration: stretch, then\n"
+        "  resample with a windowed sinc of 8/16/32 taps by quality.\n"
+        "deconvolve: impulse response (default 1 s long) of a system from its\n"
+        "  response to a sweep. With an exponential sweep (wavgen expsweep) from\n"
+        "  f1 to f2 Hz, also the IRs of harmonics 2..N (out_ir_h2.wav, ...).\n"
+        "serve: keep worker processes resident and run jobs sent by client\n"
+        "  over a Unix socket; the client prints per-job latency.\n"
+        "--cache: reuse outputs of gain, lpf, gainq, lpfq, limit and compress\n"
+        "  for the same input audio and parameters.\n"
+        "--start/--end: process only that range (samples, or 1.5s / 250ms);\n"
+        "  --preroll primes the lpf state from the samples before --start.\n"
+        "  Not for trim, split, concat, mix or deconvolve.\n"
+        "\n"
+        "latency: time each block of the gain/lpf kernel and print a latency\n"
+        "  histogram. The deadline is block_samples/sample_rate scaled by\n"
+        "  deadline_pct (default 100), i.e. the real-time budget per block.\n"
+        "\n"
+        "Notes: PCM 16-bit mono only.\n");
+    exit(2);
+}
+
+static int run_latency(int argc, char **argv) {
+    if (argc < 6 || argc > 7) usage();
+
+    const char *kernel = argv[2];
+    int is_gain = strcmp(kernel, "gain") == 0;
+    if (!is_gain && strcmp(kernel, "lpf") != 0) usage();
+
+    FILE *fin = fopen(argv[3], "rb");
+    if (!fin) die("Could not open input file");
+    wav_info_t in = read_wav_header(fin);
+    if (fseek(fin, in.data_offset, SEEK_SET) != 0) die("fseek to data failed");
+
+    double param = strtod(argv[4], NULL);
+    long block = strtol(argv[5], NULL, 10);
+    if (block <= 0 || block > 1048576) die("block_samples must be in 1..1048576");
+    double deadline_pct = (argc == 7) ? strtod(argv[6], NULL) : 100.0;
+    if (deadline_pct <= 0.0) die("deadline_pct must be > 0");
+
+    float g = (float)param;
+    float a = 0.0f;
+    if (!is_gain) {
+        if (param <= 0.0) die("cutoff_hz must be > 0");
+        a = lpf_coef(param, in.sample_rate);
+    }
+
+    // the budget for one block is the time it takes to play it back
+    double budget_ns = (double)block / (double)in.sample_rate * 1e9;
+    uint64_t deadline_ns = (uint64_t)(budget_ns * deadline_pct / 100.0);
+
+    int16_t *ibuf = malloc((size_t)block * sizeof *ibuf);
+    int16_t *obuf = malloc((size_t)block * sizeof *obuf);
+    float   *fbuf = malloc((size_t)block * sizeof *fbuf);
+    lat_hist_t *h = calloc(1, sizeof *h);
+    if (!ibuf || !obuf || !fbuf || !h) die("out of memory");
+
+    uint64_t missed = 0;
+    float y1 = 0.0f;
+    uint32_t remaining = in.data_bytes / 2;
+
+    // only the conversion + kernel is timed; file I/O is what the service
+    // replaces with its own audio callback.
+    while (remaining > 0) {
+        size_t n = remaining < (uint32_t)block ? remaining : (size_t)block;
+        read_s16_block(fin, ibuf, n);
+
+        uint64_t t0 = now_ns();
+        s16_to_float_block(ibuf, fbuf, n);
+        if (is_gain) gain_block(fbuf, n, g);
+        else y1 = lpf_block(fbuf, n, a, y1);
+        float_to_s16_block(fbuf, obuf, n);
+        uint64_t dt = now_ns() - t0;
+
+        hist_record(h, dt);
+        if (dt > deadline_ns) missed++;
+        remaining -= (uint32_t)n;
+    }
+    fclose(fin);
+
+    // keep the compiler from proving the output is unused
+    volatile int16_t sink = obuf[0];
+    (void)sink;
+
+    fprintf(report(), "kernel:   %s (%s)\n", kernel, argv[4]);
+    fprintf(report(), "block:    %ld samples @ %u Hz = %.1f us budget\n",
+            block, in.sample_rate, budget_ns / 1000.0);
+    fprintf(report(), "deadline: %.1f us (%.0f%% of budget)\n", (double)deadline_ns / 1000.0, deadline_pct);
+    fprintf(report(), "blocks:   %llu\n", (unsigned long long)h->total);
+    if (h->total > 0) {
+        fprintf(report(), "mean:     %.3f us\n", h->sum / (double)h->total / 1000.0);
+        const double ps[] = { 50.0, 90.0, 99.0, 99.9 };
+        for (size_t i = 0; i < sizeof ps / sizeof ps[0]; i++) {
+            fprintf(report(), "p%-7g %.3f us\n", ps[i], (double)hist_percentile(h, ps[i]) / 1000.0);
+        }
+        fprintf(report(), "max:      %.3f us\n", (double)h->max / 1000.0);
+        fprintf(report(), "missed:   %llu (%.4f%%)\n", (unsigned long long)missed,
+                100.0 * (double)missed / (double)h->total);
+    }
+
+    free(ibuf);
+    free(obuf);
+    free(fbuf);
+    free(h);
+    return 0;
+}
+
+static int run_compare(int argc, char **argv) {
+    if (argc != 5) usage();
+
+    const char *kernel = argv[2];
+    int is_gain = strcmp(kernel, "gain") == 0;
+    if (!is_gain && strcmp(kernel, "lpf") != 0) usage();
+
+    FILE *fin = fopen(argv[3], "rb");
+    if (!fin) die("Could not open input file");
+    wav_info_t in = read_wav_header(fin);
+    if (fseek(fin, in.data_offset, SEEK_SET) != 0) die("fseek to data failed");
+
+    double param = strtod(argv[4], NULL);
+    float g = (float)param;
+    float a = 0.0f;
+    if (!is_gain) {
+        if (param <= 0.0) die("cutoff_hz must be > 0");
+        a = lpf_coef(param, in.sample_rate);
+    }
+    // only the kernel being compared gets a fixed-point setup: a cutoff in
+    // Hz is no gain and would overflow q_gain_make() above 65.5 kHz
+    q_gain_t gq = { 0, 15 };
+    q_lpf_t  lq = { 0 };
+    if (is_gain) gq = q_gain_make(param);
+    else lq = q_lpf_make(a);
+
+    int16_t ibuf[BLOCK_SAMPLES];
+    int16_t ref[BLOCK_SAMPLES];
+    int16_t qout[BLOCK_SAMPLES];
+    float   fbuf[BLOCK_SAMPLES];
+    float y1 = 0.0f;
+
+    double sig = 0.0, noise = 0.0;
+    long max_err = 0;
+    uint64_t diffs = 0;
+    uint64_t t_float = 0, t_int = 0;
+    uint32_t remaining = in.data_bytes / 2;
+    uint32_t total = remaining;
+
+    while (remaining > 0) {
+        size_t n = remaining < BLOCK_SAMPLES ? remaining : BLOCK_SAMPLES;
+        read_s16_block(fin, ibuf, n);
+
+        uint64_t t0 = now_ns();
+        s16_to_float_block(ibuf, fbuf, n);
+        if (is_gain) gain_block(fbuf, n, g);
+        else y1 = lpf_block(fbuf, n, a, y1);
+        float_to_s16_block(fbuf, ref, n);
+        uint64_t t1 = now_ns();
+        memcpy(qout, ibuf, n * sizeof *qout);
+        if (is_gain) gain_q_block(qout, n, gq);
+        else lpf_q_block(qout, n, &lq);
+        uint64_t t2 = now_ns();
+        t_float += t1 - t0;
+        t_int += t2 - t1;
+
+        for (size_t i = 0; i < n; i++) {
+            long e = (long)qout[i] - (long)ref[i];
+            if (e != 0) diffs++;
+            if (labs(e) > max_err) max_err = labs(e);
+            sig += (double)ref[i] * (double)ref[i];
+            noise += (double)e * (double)e;
+        }
+        remaining -= (uint32_t)n;
+    }
+    fclose(fin);
+
+    fprintf(report(), "kernel:    %s (%s)\n", kernel, argv[4]);
+    fprintf(report(), "samples:   %u\n", total);
+    fprintf(report(), "max error: %ld LSB\n", max_err);
+    fprintf(report(), "differing: %llu (%.4f%%)\n", (unsigned long long)diffs,
+            total ? 100.0 * (double)diffs / (double)total : 0.0);
+    if (noise == 0.0) fprintf(report(), "SNR:       inf (bit exact)\n");
+    else fprintf(report(), "SNR:       %.2f dB\n", 10.0 * log10(sig / noise));
+    if (total > 0) {
+        fprintf(report(), "float:     %.3f ns/sample\n", (double)t_float / (double)total);
+        fprintf(report(), "integer:   %.3f ns/sample\n", (double)t_int / (double)total);
+    }
+    return 0;
+}
+
+static int run_dynamics(int argc, char **argv) {
+    int is_limit = strcmp(argv[1], "limit") == 0;
+    // limit has one required parameter, compress has two
+    int nreq = is_limit ? 5 : 6;
+    if (argc < nreq || argc > nreq + 3) usage();
+
+    double thresh_db = strtod(argv[4], NULL);
+    double ratio = is_limit ? 1.0 : strtod(argv[5], NULL);
+    if (!is_limit && ratio < 1.0) die("ratio must be >= 1");
+    double look_ms = 5.0;
+    double att_ms = is_limit ? 1.0 : 5.0;
+    double rel_ms = is_limit ? 50.0 : 100.0;
+    if (argc > nreq)     look_ms = strtod(argv[nreq], NULL);
+    if (argc > nreq + 1) att_ms = strtod(argv[nreq + 1], NULL);
+    if (argc > nreq + 2) rel_ms = strtod(argv[nreq + 2], NULL);
+    if (look_ms < 0.0 || att_ms < 0.0 || rel_ms < 0.0) die("times must be >= 0");
+
+    FILE *fin = fopen(argv[2], "rb");
+    if (!fin) die("Could not open input file");
+    wav_info_t in = read_wav_header(fin);
+    FILE *fout = fopen(argv[3], "wb");
+    if (!fout) die("Could not open output file");
+    write_wav_header_pcm16_mono(fout, in.sample_rate, in.data_bytes);
+    if (fseek(fin, in.data_offset, SEEK_SET) != 0) die("fseek to data failed");
+
+    dyn_t d;
+    dyn_init(&d, is_limit, thresh_db, ratio, look_ms, att_ms, rel_ms, in.sample_rate);
+
+    int16_t ibuf[BLOCK_SAMPLES];
+    float   fbuf[BLOCK_SAMPLES];
+    uint32_t remaining = in.data_bytes / 2;
+    // the first `look` outputs are the zeros the delay line started with
+    size_t skip = d.look;
+    size_t flush = d.look;
+
+    while (remaining > 0 || flush > 0) {
+        size_t n;
+        if (remaining > 0) {
+            n = remaining < BLOCK_SAMPLES ? remaining : BLOCK_SAMPLES;
+            read_s16_block(fin, ibuf, n);
+            s16_to_float_block(ibuf, fbuf, n);
+            remaining -= (uint32_t)n;
+        } else {
+            // push zeros through to get the tail out of the delay line
+            n = flush < BLOCK_SAMPLES ? flush : BLOCK_SAMPLES;
+            memset(fbuf, 0, n * sizeof *fbuf);
+            flush -= n;
+        }
+        dyn_block(&d, fbuf, fbuf, n);
+
+        size_t drop = skip < n ? skip : n;
+        skip -= drop;
+        float_to_s16_block(fbuf + drop, ibuf, n - drop);
+        write_s16_block(fout, ibuf, n - drop);
+    }
+
+    dyn_free(&d);
+    fclose(fin);
+    fclose(fout);
+    return 0;
+}
+
+static int run_normalize(int argc, char **argv) {
+    if (argc != 6) usage();
+
+    const char *inpath = argv[2];
+    int by_peak = strcmp(argv[4], "peak") == 0;
+    if (!by_peak && strcmp(argv[4], "rms") != 0) usage();
+    double target_db = strtod(argv[5], NULL);
+
+    FILE *fin = fopen(inpath, "rb");
+    if (!fin) die("Could not open input file");
+    wav_info_t in = read_wav_header(fin);
+    uint32_t total = in.data_bytes / 2;
+
+    char cache_path[4096];
+    if (snprintf(cache_path, sizeof cache_path, "%s.level", inpath) >= (int)sizeof cache_path) {
+        die("input path too long");
+    }
+
+    /* Pass 1: analysis, unless the sidecar still matches the file. */
+    level_t lv = {0};
+    file_key_t key;
+    // the sidecar describes the whole file, not a --start/--end range
+    int have_key = range.spec[0] == '\0' && file_key(inpath, &key) == 0;
+    int cached = have_key && level_cache_load(cache_path, &key, &lv) && lv.samples == total;
+    if (!cached) {
+        memset(&lv, 0, sizeof lv);
+        if (fseek(fin, in.data_offset, SEEK_SET) != 0) die("fseek to data failed");
+        int16_t ibuf[BLOCK_SAMPLES];
+        uint32_t remaining = total;
+        while (remaining > 0) {
+            size_t n = remaining < BLOCK_SAMPLES ? remaining : BLOCK_SAMPLES;
+            read_s16_block(fin, ibuf, n);
+            level_block(&lv, ibuf, n);
+            remaining -= (uint32_t)n;
+        }
+        if (have_key) level_cache_store(cache_path, &key, &lv);
+    }
+
+    // levels relative to full scale as float_to_s16() defines it (32767)
+    double peak = lv.peak > 32767 ? 1.0 : (double)lv.peak / 32767.0;
+    double rms = lv.samples ? sqrt(lv.sumsq / (double)lv.samples) / 32767.0 : 0.0;
+    double level = by_peak ? peak : rms;
+    double g = 1.0;
+    if (level > 0.0) g = pow(10.0, target_db / 20.0) / level;
+    else fprintf(stderr, "warning: input is silent, gain left at 0 dB\n");
+
+    fprintf(report(), "peak: %.2f dBFS  rms: %.2f dBFS  gain: %+.2f dB%s\n",
+            peak > 0.0 ? 20.0 * log10(peak) : -INFINITY,
+            rms > 0.0 ? 20.0 * log10(rms) : -INFINITY,
+            20.0 * log10(g), cached ? "  (cached analysis)" : "");
+
+    /* Pass 2: apply the gain. */
+    FILE *fout = fopen(argv[3], "wb");
+    if (!fout) die("Could not open output file");
+    write_wav_header_pcm16_mono(fout, in.sample_rate, in.data_bytes);
+    if (fseek(fin, in.data_offset, SEEK_SET) != 0) die("fseek to data failed");
+
+    int16_t ibuf[BLOCK_SAMPLES];
+    float   fbuf[BLOCK_SAMPLES];
+    uint32_t remaining = total;
+    while (remaining > 0) {
+        size_t n = remaining < BLOCK_SAMPLES ? remaining : BLOCK_SAMPLES;
+        read_s16_block(fin, ibuf, n);
+        s16_to_float_block(ibuf, fbuf, n);
+        gain_block(fbuf, n, (float)g);
+        float_to_s16_block(fbuf, ibuf, n);
+        write_s16_block(fout, ibuf, n);
+        remaining -= (uint32_t)n;
+    }
+
+    fclose(fin);
+    fclose(fout);
+    return 0;
+}
+
+static int run_loudness(int argc, char **argv) {
+    if (argc < 3 || argc > 4) usage();
+    const char *inpath = argv[2];
+
+    FILE *fin = fopen(inpath, "rb");
+    if (!fin) die("Could not open input file");
+    wav_info_t in = read_wav_header(fin);
+    fclose(fin);
+
+    uint64_t total = in.data_bytes / 2;
+    size_t sub = (size_t)llround((double)in.sample_rate / LOUD_SUBBLOCKS_PER_S);
+    size_t nsub = (size_t)(total / sub);
+
+    long threads = argc == 4 ? strtol(argv[3], NULL, 10) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1) threads = 1;
+    // a chunk much shorter than the preroll would be mostly wasted work
+    long max_threads = (long)(nsub / (10 * LOUD_SUBBLOCKS_PER_S));
+    if (threads > max_threads) threads = max_threads > 0 ? max_threads : 1;
+
+    double *energy = calloc(nsub > 0 ? nsub : 1, sizeof *energy);
+    loud_job_t *jobs = calloc((size_t)threads, sizeof *jobs);
+    pthread_t *tids = calloc((size_t)threads, sizeof *tids);
+    if (!energy || !jobs || !tids) die("out of memory");
+
+    uint64_t t0 = now_ns();
+    for (long t = 0; t < threads; t++) {
+        loud_job_t *j = &jobs[t];
+        size_t s0 = (size_t)((uint64_t)nsub * (uint64_t)t / (uint64_t)threads);
+        size_t s1 = (size_t)((uint64_t)nsub * (uint64_t)(t + 1) / (uint64_t)threads);
+        uint64_t preroll = (uint64_t)LOUD_PREROLL_S * in.sample_rate;
+        j->path = inpath;
+        j->data_offset = in.data_offset;
+        j->sample_rate = in.sample_rate;
+        j->sub = sub;
+        j->first = (uint64_t)s0 * sub;
+        j->start = j->first > preroll ? j->first - preroll : 0;
+        // the last chunk also covers the partial sub-block at the end (for peaks)
+        j->end = t == threads - 1 ? total : (uint64_t)s1 * sub;
+        j->energy = energy + s0;
+        j->nsub = s1 - s0;
+        if (pthread_create(&tids[t], NULL, loud_worker, j) != 0) die("pthread_create failed");
+    }
+
+    float peak = 0.0f, tpeak = 0.0f;
+    for (long t = 0; t < threads; t++) {
+        pthread_join(tids[t], NULL);
+        if (jobs[t].peak > peak) peak = jobs[t].peak;
+        if (jobs[t].true_peak > tpeak) tpeak = jobs[t].true_peak;
+    }
+    uint64_t t1 = now_ns();
+
+    /* Merge: walk the sub-block energies once, building the gating
+       histogram from 400 ms blocks and collecting 3 s short-term values
+       for the loudness range. */
+    gate_hist_t *gh = calloc(1, sizeof *gh);
+    double *st = malloc((nsub > 0 ? nsub : 1) * sizeof *st);
+    if (!gh || !st) die("out of memory");
+    size_t nst = 0;
+    double m_max = -INFINITY, s_max = -INFINITY;
+    double sum4 = 0.0, sum30 = 0.0;
+    for (size_t i = 0; i < nsub; i++) {
+        sum4 += energy[i];
+        sum30 += energy[i];
+        if (i >= 4) sum4 -= energy[i - 4];
+        if (i >= 30) sum30 -= energy[i - 30];
+        if (i >= 3) {
+            double ms = sum4 / (4.0 * (double)sub);
+            gate_add(gh, ms);
+            if (lufs(ms) > m_max) m_max = lufs(ms);
+        }
+        if (i >= 29) {
+            double l = lufs(sum30 / (30.0 * (double)sub));
+            if (l > s_max) s_max = l;
+            st[nst++] = l;
+        }
+    }
+
+    double ungated = gate_mean(gh, GATE_MIN_LUFS);
+    double integrated = gate_mean(gh, ungated - 10.0);
+
+    // loudness range (EBU Tech 3342): short-term values gated at -70 LUFS
+    // and 20 LU below their mean, then the 10th to 95th percentile spread
+    double lra = 0.0;
+    {
+        double e = 0.0;
+        size_t k = 0;
+        for (size_t i = 0; i < nst; i++) {
+            if (st[i] >= GATE_MIN_LUFS) {
+                e += pow(10.0, (st[i] + 0.691) / 10.0);
+                st[k++] = st[i];
+            }
+        }
+        if (k > 0) {
+            double rel = lufs(e / (double)k) - 20.0;
+            size_t m = 0;
+            for (size_t i = 0; i < k; i++) if (st[i] >= rel) st[m++] = st[i];
+            if (m > 0) {
+                qsort(st, m, sizeof *st, cmp_double);
+                size_t lo = (size_t)llround(0.10 * (double)(m - 1));
+                size_t hi = (size_t)llround(0.95 * (double)(m - 1));
+                lra = st[hi] - st[lo];
+            }
+        }
+    }
+
+    double secs = (double)total / (double)in.sample_rate;
+    double wall = (double)(t1 - t0) * 1e-9;
+    fprintf(report(), "integrated:     %.1f LUFS\n", integrated);
+    fprintf(report(), "loudness range: %.1f LU\n", lra);
+    fprintf(report(), "momentary max:  %.1f LUFS\n", m_max);
+    fprintf(report(), "short-term max: %.1f LUFS\n", s_max);
+    fprintf(report(), "true peak:      %.1f dBTP\n", tpeak > 0.0f ? 20.0 * log10(tpeak) : -INFINITY);
+    fprintf(report(), "sample peak:    %.1f dBFS\n", peak > 0.0f ? 20.0 * log10(peak) : -INFINITY);
+    fprintf(report(), "analysed %.1f s in %.3f s (%.0fx real time, %ld thread%s)\n",
+            secs, wall, wall > 0.0 ? secs / wall : 0.0, threads, threads == 1 ? "" : "s");
+
+    free(gh);
+    free(st);
+    free(energy);
+    free(jobs);
+    free(tids);
+    return 0;
+}
+
+static int run_stft(int argc, char **argv) {
+    if (argc < 6 || argc > 9) usage();
+
+    size_t nfft = (size_t)strtoul(argv[4], NULL, 10);
+    size_t hop = (size_t)strtoul(argv[5], NULL, 10);
+    if (hop == 0) die("hop must be > 0");
+
+    const char *wspec = argc > 6 ? argv[6] : "hann";
+    char wname[32];
+    size_t win = nfft;
+    const char *colon = strchr(wspec, ':');
+    size_t wlen = colon ? (size_t)(colon - wspec) : strlen(wspec);
+    if (wlen >= sizeof wname) usage();
+    memcpy(wname, wspec, wlen);
+    wname[wlen] = '\0';
+    if (colon) win = (size_t)strtoul(colon + 1, NULL, 10);
+    if (win == 0 || win > nfft) die("window length must be in 1..fft_size");
+
+    stft_out_t what = STFT_MAG;
+    if (argc > 7) {
+        if (strcmp(argv[7], "mag") == 0) what = STFT_MAG;
+        else if (strcmp(argv[7], "db") == 0) what = STFT_DB;
+        else if (strcmp(argv[7], "magphase") == 0) what = STFT_MAGPHASE;
+        else usage();
+    }
+    long threads = argc > 8 ? strtol(argv[8], NULL, 10) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1) threads = 1;
+
+    fft_plan_t *plan = fft_plan_new(nfft);
+
+    // window table, computed once (periodic form, as used for spectral analysis)
+    const double two_pi = 2.0 * acos(-1.0);
+    float *window = malloc(win * sizeof *window);
+    if (!window) die("out of memory");
+    for (size_t i = 0; i < win; i++) {
+        double ph = two_pi * (double)i / (double)win;
+        double w;
+        if (strcmp(wname, "hann") == 0) w = 0.5 - 0.5 * cos(ph);
+        else if (strcmp(wname, "hamming") == 0) w = 0.54 - 0.46 * cos(ph);
+        else if (strcmp(wname, "blackman") == 0) w = 0.42 - 0.5 * cos(ph) + 0.08 * cos(2.0 * ph);
+        else if (strcmp(wname, "rect") == 0) w = 1.0;
+        else die("unknown window (hann, hamming, blackman, rect)");
+        window[i] = (float)w;
+    }
+
+    FILE *fin = fopen(argv[2], "rb");
+    if (!fin) die("Could not open input file");
+    wav_info_t in = read_wav_header(fin);
+
+    // A header that claims more data than the file holds (a cut file, or a
+    // streaming recorder's 0xFFFFFFFF) would make the mapping run past EOF
+    // and fault on the first read there, so clamp to what is on disk. A
+    // size of 0 from a recorder that never patched it means "to the end".
+    struct stat st;
+    if (fstat(fileno(fin), &st) != 0) die("fstat failed");
+    if ((uint64_t)st.st_size < (uint64_t)in.data_offset) die("input is shorter than its header");
+    uint64_t on_disk = (uint64_t)st.st_size - (uint64_t)in.data_offset;
+    if (in.data_bytes > on_disk || (in.data_bytes == 0 && !range.start.set && !range.end.set)) {
+        in.data_bytes = (uint32_t)(on_disk < 0xFFFFFFFEu ? on_disk : 0xFFFFFFFEu);
+    }
+    in.data_bytes &= ~1u;
+    if (in.data_bytes == 0) die("no samples in input");
+    uint64_t total = in.data_bytes / 2;
+
+    // map the whole file; the data chunk starts at in.data_offset
+    size_t map_len = (size_t)in.data_offset + (size_t)in.data_bytes;
+    uint8_t *map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fileno(fin), 0);
+    if (map == MAP_FAILED) die("mmap of input failed");
+    posix_madvise(map, map_len, POSIX_MADV_SEQUENTIAL);
+
+    uint64_t frames = total <= win ? 1 : 1 + (total - win + hop - 1) / hop;
+    size_t bins = nfft / 2 + 1;
+    size_t row_bytes = bins * 4 * (what == STFT_MAGPHASE ? 2 : 1);
+
+    char shape[96];
+    if (what == STFT_MAGPHASE) {
+        snprintf(shape, sizeof shape, "(%llu, %zu, 2)", (unsigned long long)frames, bins);
+    } else {
+        snprintf(shape, sizeof shape, "(%llu, %zu)", (unsigned long long)frames, bins);
+    }
+    uint8_t hdr[256];
+    size_t hdr_len = npy_header(hdr, sizeof hdr, shape);
+
+    int fd = open(argv[3], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) die("Could not open output file");
+    if (pwrite(fd, hdr, hdr_len, 0) != (ssize_t)hdr_len) die("stft: pwrite failed");
+    // size the file up front so the threads can fill it in any order
+    if (ftruncate(fd, (off_t)(hdr_len + frames * row_bytes)) != 0) die("ftruncate failed");
+
+    if ((uint64_t)threads > frames) threads = (long)frames;
+    stft_job_t *jobs = calloc((size_t)threads, sizeof *jobs);
+    pthread_t *tids = calloc((size_t)threads, sizeof *tids);
+    if (!jobs || !tids) die("out of memory");
+    for (long t = 0; t < threads; t++) {
+        stft_job_t *j = &jobs[t];
+        j->plan = plan;
+        j->window = window;
+        j->win = win;
+        j->hop = hop;
+        j->pcm = map + in.data_offset;
+        j->total = total;
+        j->what = what;
+        j->fd = fd;
+        j->data_start = (off_t)hdr_len;
+        j->row_bytes = row_bytes;
+        j->f0 = frames * (uint64_t)t / (uint64_t)threads;
+        j->f1 = frames * (uint64_t)(t + 1) / (uint64_t)threads;
+        if (pthread_create(&tids[t], NULL, stft_worker, j) != 0) die("pthread_create failed");
+    }
+    for (long t = 0; t < threads; t++) pthread_join(tids[t], NULL);
+
+    if (close(fd) != 0) die("close of output failed");
+    munmap(map, map_len);
+    fclose(fin);
+    fft_plan_free(plan);
+    free(window);
+    free(jobs);
+    free(tids);
+    return 0;
+}
+
+// out_template with {} replaced by value, or value appended before ".wav"
+static void sweep_path(char *dst, size_t cap, const char *tmpl, const char *value) {
+    const char *mark = strstr(tmpl, "{}");
+    int len;
+    if (mark) {
+        len = snprintf(dst, cap, "%.*s%s%s", (int)(mark - tmpl), tmpl, value, mark + 2);
+    } else {
+        const char *dot = strrchr(tmpl, '.');
+        if (!dot) dot = tmpl + strlen(tmpl);
+        len = snprintf(dst, cap, "%.*s_%s%s", (int)(dot - tmpl), tmpl, value, dot);
+    }
+    if (len < 0 || (size_t)len >= cap) die("output path too long");
+}
+
+static int run_sweep(int argc, char **argv) {
+    if (argc != 6) usage();
+
+    int is_gain = strcmp(argv[2], "gain") == 0;
+    if (!is_gain && strcmp(argv[2], "lpf") != 0) usage();
+
+    FILE *fin = fopen(argv[3], "rb");
+    if (!fin) die("Could not open input file");
+    wav_info_t in = read_wav_header(fin);
+
+    // split the value list; keep the strings for the output names
+    char *list = strdup(argv[5]);
+    if (!list) die("out of memory");
+    size_t cap = 1;
+    for (const char *c = list; *c; c++) if (*c == ',') cap++;
+    char **vals = calloc(cap, sizeof *vals);
+    if (!vals) die("out of memory");
+    size_t K = 0;
+    for (char *tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) vals[K++] = tok;
+    if (K == 0) usage();
+
+    size_t groups = (K + SWEEP_LANES - 1) / SWEEP_LANES;
+    sweep_group_t *grp = calloc(groups, sizeof *grp);
+    FILE **fout = calloc(K, sizeof *fout);
+    if (!grp || !fout) die("out of memory");
+
+    for (size_t k = 0; k < K; k++) {
+        double v = strtod(vals[k], NULL);
+        float c;
+        if (is_gain) {
+            c = (float)v;
+        } else {
+            if (v <= 0.0) die("cutoff_hz must be > 0");
+            c = lpf_coef(v, in.sample_rate);
+        }
+        grp[k / SWEEP_LANES].a[k % SWEEP_LANES] = c;
+
+        char path[4096];
+        sweep_path(path, sizeof path, argv[4], vals[k]);
+        fout[k] = fopen(path, "wb");
+        if (!fout[k]) die("Could not open output file");
+        write_wav_header_pcm16_mono(fout[k], in.sample_rate, in.data_bytes);
+    }
+
+    if (fseek(fin, in.data_offset, SEEK_SET) != 0) die("fseek to data failed");
+
+    int16_t ibuf[BLOCK_SAMPLES];
+    float   fbuf[BLOCK_SAMPLES];
+    float  *lanes = malloc((size_t)BLOCK_SAMPLES * SWEEP_LANES * sizeof *lanes);
+    float  *col = malloc((size_t)BLOCK_SAMPLES * sizeof *col);
+    if (!lanes || !col) die("out of memory");
+
+    uint32_t remaining = in.data_bytes / 2;
+    while (remaining > 0) {
+        size_t n = remaining < BLOCK_SAMPLES ? remaining : BLOCK_SAMPLES;
+        read_s16_block(fin, ibuf, n);
+        s16_to_float_block(ibuf, fbuf, n);
+
+        for (size_t gi = 0; gi < groups; gi++) {
+            if (is_gain) sweep_gain_block(&grp[gi], fbuf, lanes, n);
+            else sweep_lpf_block(&grp[gi], fbuf, lanes, n);
+
+            for (size_t k = 0; k < SWEEP_LANES; k++) {
+                size_t idx = gi * SWEEP_LANES + k;
+                if (idx >= K) break;
+                for (size_t i = 0; i < n; i++) col[i] = lanes[i * SWEEP_LANES + k];
+                float_to_s16_block(col, ibuf, n);
+                write_s16_block(fout[idx], ibuf, n);
+            }
+        }
+        remaining -= (uint32_t)n;
+    }
+
+    for (size_t k = 0; k < K; k++) {
+        if (fclose(fout[k]) != 0) die("fclose of output failed");
+    }
+    fclose(fin);
+    free(lanes);
+    free(col);
+    free(grp);
+    free(fout);
+    free(vals);
+    free(list);
+    return 0;
+}
+
+// gain, lpf, gainq, lpfq
+/*
+Parameter automation for gain and lpf: "@file" in place of the value.
+
+The file has one breakpoint per line, "<time> <value>", the time in
+samples or as 1.5s / 250ms from the start of the file. Between
+breakpoints the gain is interpolated linearly and the cutoff
+geometrically (linearly in octaves); before the first and after the last
+the value is held.
+
+Both parameters move at a control rate of AUTO_CTRL samples, with a
+per-sample linear ramp between control points, so the inner loops keep a
+fixed trip count:
+
+- gain: each control point's target goes through a one-pole smoother
+  (AUTO_SMOOTH_MS), so a jump in the file becomes a short ramp rather
+  than a click.
+- cutoff: lpf_coef() calls acos() and divides twice, too slow to redo
+  per sample. With w = fc * (2 pi / sr), the same dt / (rc + dt) is
+  w / (1 + w): a multiply, an add and a divide, only at control points.
+  The coefficient ramps linearly in between.
+
+"autobench" times the static and automated kernels, and the naive
+per-sample version, on the same input.
+*/
+#define AUTO_CTRL       32
+#define AUTO_SMOOTH_MS  5.0
+
+typedef struct {
+    size_t    n;
+    uint64_t *s;            // breakpoint positions in samples
+    double   *v;
+    int       geometric;    // interpolate log(v) (cutoff)
+} autom_t;
+
+static autom_t autom_load(const char *path, uint32_t sample_rate, int geometric) {
+    autom_t au = { 0, NULL, NULL, geometric };
+    FILE *f = fopen(path, "r");
+    if (!f) die("Could not open automation file");
+    size_t cap = 0;
+    char line[256];
+    while (fgets(line, sizeof line, f)) {
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+        char tbuf[64];
+        double v;
+        int got = sscanf(line, "%63s %lf", tbuf, &v);
+        if (got <= 0) continue;
+        wav_pos_t p;
+        if (got != 2 || parse_pos(tbuf, &p) != 0) die("automation: each line is <time> <value>");
+        if (geometric && !(v > 0.0)) die("automation: cutoff values must be > 0");
+        if (au.n == cap) {
+            cap = cap ? 2 * cap : 64;
+            au.s = realloc(au.s, cap * sizeof *au.s);
+            au.v = realloc(au.v, cap * sizeof *au.v);
+            if (!au.s || !au.v) die("out of memory");
+        }
+        au.s[au.n] = pos_samples(&p, sample_rate);
+        au.v[au.n] = v;
+        if (au.n > 0 && au.s[au.n] < au.s[au.n - 1]) die("automation: times must be in order");
+        au.n++;
+    }
+    fclose(f);
+    if (au.n == 0) die("automation: no breakpoints");
+    return au;
+}
+
+/* Value at sample pos. *k is the caller's cursor (first breakpoint after
+   the previous position); positions only move forward. */
+static double autom_at(const autom_t *au, size_t *k, uint64_t pos) {
+    while (*k < au->n && au->s[*k] <= pos) (*k)++;
+    if (*k == 0) return au->v[0];
+    if (*k == au->n) return au->v[au->n - 1];
+    const double v0 = au->v[*k - 1], v1 = au->v[*k];
+    const double u = (double)(pos - au->s[*k - 1]) / (double)(au->s[*k] - au->s[*k - 1]);
+    return au->geometric ? v0 * pow(v1 / v0, u) : v0 + (v1 - v0) * u;
+}
+
+typedef struct {
+    const autom_t *au;
+    size_t   k;             // autom_at() cursor
+    uint64_t pos;           // file position of the next sample
+    float    cur;           // gain, or lpf coefficient, at the last control point
+    float    smooth;        // gain: smoother step per control point
+    float    w_per_hz;      // lpf: 2 pi / sample_rate
+} auto_state_t;
+
+static float auto_coef(const auto_state_t *st, double cutoff) {
+    float w = (float)cutoff * st->w_per_hz;
+    return w / (1.0f + w);
+}
+
+static void auto_init(auto_state_t *st, const autom_t *au, int is_lpf, uint32_t sample_rate, uint64_t pos) {
+    memset(st, 0, sizeof *st);
+    st->au = au;
+    st->pos = pos;
+    st->w_per_hz = (float)(2.0 * acos(-1.0) / (double)sample_rate);
+    double steps = AUTO_SMOOTH_MS * 1e-3 * (double)sample_rate / AUTO_CTRL;
+    st->smooth = (float)(1.0 - exp(-1.0 / steps));
+    double v = autom_at(au, &st->k, pos);
+    st->cur = is_lpf ? auto_coef(st, v) : (float)v;
+}
+
+static void gain_auto_block(auto_state_t *st, float *x, size_t n) {
+    for (size_t i = 0; i < n; i += AUTO_CTRL) {
+        size_t m = n - i < AUTO_CTRL ? n - i : AUTO_CTRL;
+        float target = (float)autom_at(st->au, &st->k, st->pos + i + AUTO_CTRL);
+        float next = st->cur + st->smooth * (target - st->cur);
+        float g0 = st->cur, d = (next - st->cur) / AUTO_CTRL;
+        if (m == AUTO_CTRL) {
+            // int j: (float) of a size_t has no SIMD form on x86-64
+            for (int j = 0; j < AUTO_CTRL; j++) x[i + j] *= g0 + d * (float)(j + 1);
+        } else {
+            for (int j = 0; j < (int)m; j++) x[i + j] *= g0 + d * (float)(j + 1);
+        }
+        st->cur = g0 + d * (float)m;
+    }
+    st->pos += n;
+}
+
+static float lpf_auto_block(auto_state_t *st, float *x, size_t n, float y1) {
+    for (size_t i = 0; i < n; i += AUTO_CTRL) {
+        size_t m = n - i < AUTO_CTRL ? n - i : AUTO_CTRL;
+        float next = auto_coef(st, autom_at(st->au, &st->k, st->pos + i + AUTO_CTRL));
+        float a0 = st->cur, d = (next - st->cur) / AUTO_CTRL;
+        float a[AUTO_CTRL];
+        for (int j = 0; j < AUTO_CTRL; j++) a[j] = a0 + d * (float)(j + 1);
+        for (size_t j = 0; j < m; j++) {
+            y1 = y1 + a[j] * (x[i + j] - y1);
+            x[i + j] = y1;
+        }
+        st->cur = a[m - 1];
+    }
+    st->pos += n;
+    return y1;
+}
+
+static int run_simple(int argc, char **argv) {
+    if (argc != 5) usage();
+
+    const char *mode = argv[1];
+
+    const char *inpath  = argv[2];
+    const char *outpath = argv[3];
+
+    FILE *fin = fopen(inpath, "rb");
+    if (!fin) die("Could not open input file");
+    wav_info_t in = read_wav_header(fin);
+
+    FILE *fout = fopen(outpath, "wb");
+    if (!fout) die("Could not open output file");
+
+    /* Same format out as in (PCM16 mono), same data length. */
+    write_wav_header_pcm16_mono(fout, in.sample_rate, in.data_bytes);
+
+    uint32_t total_samples = in.data_bytes / 2;
+
+    // gain/gainq vs lpf/lpfq, and float vs integer
+    int is_gain = strncmp(mode, "gain", 4) == 0;
+    int is_int = mode[strlen(mode) - 1] == 'q';
+    float g = 0.0f;
+    float a = 0.0f;
+    autom_t au = { 0, NULL, NULL, 0 };
+    auto_state_t as;
+    if (argv[4][0] == '@') {
+        if (is_int) die("automation (@file) works with gain and lpf only");
+        au = autom_load(argv[4] + 1, in.sample_rate, !is_gain);
+    } else if (is_gain) {
+        g = (float)strtod(argv[4], NULL);
+    } else {
+        double cutoff = strtod(argv[4], NULL);
+        if (cutoff <= 0.0) die("cutoff_hz must be > 0");
+        a = lpf_coef(cutoff, in.sample_rate);
+    }
+    // fixed-point setup for gainq/lpfq only; the float gain has no range limit
+    q_gain_t gq = { 0, 15 };
+    q_lpf_t  lq = { 0 };
+    if (is_int && is_gain) gq = q_gain_make(g);
+    else if (is_int) lq = q_lpf_make(a);
+
+    int16_t ibuf[BLOCK_SAMPLES];
+    float   fbuf[BLOCK_SAMPLES];
+    float y1 = 0.0f;
+
+    // with --preroll, run the filter over the samples just before the range
+    // and throw them away, so the output starts from settled state rather
+    // than from silence
+    uint32_t preroll = is_gain ? 0 : in.preroll;
+    if (au.n) {
+        // automation times count from the start of the file, not of --start
+        uint64_t start = range.start.set ? pos_samples(&range.start, in.sample_rate) : 0;
+        auto_init(&as, &au, !is_gain, in.sample_rate, start - preroll);
+    }
+    if (fseek(fin, in.data_offset - 2L * (long)preroll, SEEK_SET) != 0) die("fseek to data failed");
+    while (preroll > 0) {
+        size_t n = preroll < BLOCK_SAMPLES ? preroll : BLOCK_SAMPLES;
+        read_s16_block(fin, ibuf, n);
+        if (is_int) {
+            lpf_q_block(ibuf, n, &lq);
+        } else {
+            s16_to_float_block(ibuf, fbuf, n);
+            if (au.n) y1 = lpf_auto_block(&as, fbuf, n, y1);
+            else y1 = lpf_block(fbuf, n, a, y1);
+        }
+        preroll -= (uint32_t)n;
+    }
+
+    uint32_t remaining = total_samples;
+    while (remaining > 0) {
+        size_t n = remaining < BLOCK_SAMPLES ? remaining : BLOCK_SAMPLES;
+        read_s16_block(fin, ibuf, n);
+        if (is_int) {
+            if (is_gain) gain_q_block(ibuf, n, gq);
+            else lpf_q_block(ibuf, n, &lq);
+        } else {
+            s16_to_float_block(ibuf, fbuf, n);
+            if (au.n && is_gain) gain_auto_block(&as, fbuf, n);
+            else if (au.n) y1 = lpf_auto_block(&as, fbuf, n, y1);
+            else if (is_gain) gain_block(fbuf, n, g);
+            else y1 = lpf_block(fbuf, n, a, y1);
+            float_to_s16_block(fbuf, ibuf, n);
+        }
+        write_s16_block(fout, ibuf, n);
+        remaining -= (uint32_t)n;
+    }
+
+    free(au.s);
+    free(au.v);
+    fclose(fin);
+    fclose(fout);
+    return 0;
+}
+
+static int run_autobench(int argc, char **argv) {
+    // autobench <gain|lpf> <in.wav> <automation file>
+    if (argc != 5) usage();
+    int is_gain = strcmp(argv[2], "gain") == 0;
+    if (!is_gain && strcmp(argv[2], "lpf") != 0) usage();
+
+    FILE *fin = fopen(argv[3], "rb");
+    if (!fin) die("Could not open input file");
+    wav_info_t in = read_wav_header(fin);
+    if (fseek(fin, in.data_offset, SEEK_SET) != 0) die("fseek to data failed");
+    autom_t au = autom_load(argv[4], in.sample_rate, !is_gain);
+
+    // static: the first breakpoint's value for the whole file
+    float g = (float)au.v[0];
+    float a = is_gain ? 0.0f : lpf_coef(au.v[0], in.sample_rate);
+    auto_state_t as;
+    auto_init(&as, &au, !is_gain, in.sample_rate, 0);
+    size_t naive_k = 0;
+
+    int16_t ibuf[BLOCK_SAMPLES];
+    float   src[BLOCK_SAMPLES], fbuf[BLOCK_SAMPLES];
+    float   y_static = 0.0f, y_auto = 0.0f, y_naive = 0.0f;
+    uint64_t t_static = 0, t_auto = 0, t_naive = 0, pos = 0;
+    double sink = 0.0;
+    uint32_t remaining = in.data_bytes / 2, total = remaining;
+
+    // only the kernels are timed, each on its own copy of the block
+    while (remaining > 0) {
+        size_t n = remaining < BLOCK_SAMPLES ? remaining : BLOCK_SAMPLES;
+        read_s16_block(fin, ibuf, n);
+        s16_to_float_block(ibuf, src, n);
+
+        memcpy(fbuf, src, n * sizeof *fbuf);
+        uint64_t t0 = now_ns();
+        if (is_gain) gain_block(fbuf, n, g);
+        else y_static = lpf_block(fbuf, n, a, y_static);
+        t_static += now_ns() - t0;
+        sink += fbuf[n - 1];
+
+        memcpy(fbuf, src, n * sizeof *fbuf);
+        t0 = now_ns();
+        if (is_gain) gain_auto_block(&as, fbuf, n);
+        else y_auto = lpf_auto_block(&as, fbuf, n, y_auto);
+        t_auto += now_ns() - t0;
+        sink += fbuf[n - 1];
+
+        // naive: the parameter, and for lpf lpf_coef(), every sample
+        memcpy(fbuf, src, n * sizeof *fbuf);
+        t0 = now_ns();
+        for (size_t i = 0; i < n; i++) {
+            double v = autom_at(&au, &naive_k, pos + i);
+            if (is_gain) {
+                fbuf[i] *= (float)v;
+            } else {
+                y_naive += lpf_coef(v, in.sample_rate) * (fbuf[i] - y_naive);
+                fbuf[i] = y_naive;
+            }
+        }
+        t_naive += now_ns() - t0;
+        sink += fbuf[n - 1];
+
+        pos += n;
+        remaining -= (uint32_t)n;
+    }
+    fclose(fin);
+
+    fprintf(report(), "kernel:    %s, %zu breakpoints, %u samples\n", argv[2], au.n, total);
+    if (total > 0) {
+        fprintf(report(), "static:    %.3f ns/sample\n", (double)t_static / (double)total);
+        fprintf(report(), "automated: %.3f ns/sample (control every %d samples)\n",
+                (double)t_auto / (double)total, AUTO_CTRL);
+        fprintf(report(), "naive:     %.3f ns/sample (per-sample parameter%s)\n",
+                (double)t_naive / (double)total, is_gain ? "" : " and lpf_coef()");
+    }
+    // keep the compiler from proving the outputs are unused
+    volatile double keep = sink;
+    (void)keep;
+    free(au.s);
+    free(au.v);
+    return 0;
+}
+
+/*
+trim, concat and split never look at a sample: they write a new header
+with write_wav_header_pcm16_mono() and move the payload with
+copy_file_range(), which copies inside the kernel and, on filesystems with
+reflinks (btrfs, XFS), shares the extents instead of copying wherever the
+offsets line up. Where it is not available (old kernels, different
+filesystems on each side) the copy falls back to 1 MB pread()/pwrite().
+*/
+static void copy_range(int in, off_t ioff, int out, off_t ooff, uint64_t len) {
+    while (len > 0) {
+        size_t want = len > ((uint64_t)1 << 30) ? (size_t)1 << 30 : (size_t)len;
+        ssize_t k = copy_file_range(in, &ioff, out, &ooff, want, 0);
+        if (k > 0) {
+            len -= (uint64_t)k;
+            continue;
+        }
+        if (k == 0) die("copy_range: unexpected end of input");
+        if (errno == EINTR) continue;
+        if (errno != EXDEV && errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP) {
+            die("copy_file_range failed");
+        }
+        break;
+    }
+    if (len == 0) return;
+
+    static uint8_t buf[1 << 20];
+    while (len > 0) {
+        size_t want = len < sizeof buf ? (size_t)len : sizeof buf;
+        ssize_t k = pread(in, buf, want, ioff);
+        if (k <= 0) die("copy_range: read failed");
+        if (pwrite(out, buf, (size_t)k, ooff) != k) die("copy_range: write failed");
+        ioff += k;
+        ooff += k;
+        len -= (uint64_t)k;
+    }
+}
+
+// header through stdio, then the payload at its offset behind it
+static FILE *open_output_with_header(const char *path, uint32_t sample_rate, uint64_t data_bytes) {
+    if (data_bytes > 0xFFFFFFFFu - 36) die("output larger than a WAV file can describe (4 GB)");
+    FILE *f = fopen(path, "wb");
+    if (!f) die("Could not open output file");
+    write_wav_header_pcm16_mono(f, sample_rate, (uint32_t)data_bytes);
+    if (fflush(f) != 0) die("write header failed");
+    return f;
+}
+
+static int run_trim(int argc, char **argv) {
+    if (argc != 6) usage();
+    wav_pos_t a, b;
+    if (parse_pos(argv[4], &a) != 0 || parse_pos(argv[5], &b) != 0) {
+        die("bad position (use samples, <x>s or <x>ms)");
+    }
+
+    FILE *fin = fopen(argv[2], "rb");
+    if (!fin) die("Could not open input file");
+    wav_info_t in = read_wav_header(fin);
+    uint64_t total = in.data_bytes / 2;
+    uint64_t s0 = pos_samples(&a, in.sample_rate);
+    uint64_t s1 = pos_samples(&b, in.sample_rate);
+    if (s1 > total) s1 = total;
+    if (s0 > s1) die("start is past end or the end of the data");
+
+    uint64_t bytes = (s1 - s0) * 2;
+    FILE *fout = open_output_with_header(argv[3], in.sample_rate, bytes);
+    copy_range(fileno(fin), (off_t)(in.data_offset + (long)(s0 * 2)), fileno(fout), 44, bytes);
+
+    fclose(fin);
+    if (fclose(fout) != 0) die("fclose of output failed");
+    return 0;
+}
+
+static int run_concat(int argc, char **argv) {
+    if (argc < 4) usage();
+    int nin = argc - 3;
+    FILE **fin = calloc((size_t)nin, sizeof *fin);
+    wav_info_t *info = calloc((size_t)nin, sizeof *info);
+    if (!fin || !info) die("out of memory");
+
+    // check everything before writing anything
+    uint64_t bytes = 0;
+    for (int i = 0; i < nin; i++) {
+        fin[i] = fopen(argv[3 + i], "rb");
+        if (!fin[i]) die("Could not open input file");
+        info[i] = read_wav_header(fin[i]);
+        if (info[i].sample_rate != info[0].sample_rate) die("concat: inputs have different sample rates");
+        bytes += info[i].data_bytes & ~1u;
+    }
+
+    FILE *fout = open_output_with_header(argv[2], info[0].sample_rate, bytes);
+    off_t at = 44;
+    for (int i = 0; i < nin; i++) {
+        uint64_t len = info[i].data_bytes & ~1u;
+        copy_range(fileno(fin[i]), (off_t)info[i].data_offset, fileno(fout), at, len);
+        at += (off_t)len;
+        fclose(fin[i]);
+    }
+    if (fclose(fout) != 0) die("fclose of output failed");
+    free(fin);
+    free(info);
+    return 0;
+}
+
+static int run_split(int argc, char **argv) {
+    if (argc != 5) usage();
+    wav_pos_t seg;
+    if (parse_pos(argv[4], &seg) != 0) die("bad segment length (use samples, <x>s or <x>ms)");
+
+    FILE *fin = fopen(argv[2], "rb");
+    if (!fin) die("Could not open input file");
+    wav_info_t in = read_wav_header(fin);
+
+    // Long captures written by streaming recorders often leave the data
+    // size at 0 or 0xFFFFFFFF because they never came back to patch it;
+    // in that case the data runs to the end of the file.
+    uint64_t payload = in.data_bytes;
+    if (payload == 0 || payload == 0xFFFFFFFFu) {
+        struct stat st;
+        if (fstat(fileno(fin), &st) != 0) die("fstat failed");
+        payload = (uint64_t)st.st_size - (uint64_t)in.data_offset;
+    }
+    uint64_t total = payload / 2;
+    uint64_t len = pos_samples(&seg, in.sample_rate);
+    if (len == 0) die("segment length must be > 0");
+    uint64_t count = (total + len - 1) / len;
+
+    int width = 1;
+    for (uint64_t c = count > 0 ? count - 1 : 0; c >= 10; c /= 10) width++;
+    for (uint64_t k = 0; k < count; k++) {
+        uint64_t s0 = k * len;
+        uint64_t n = total - s0 < len ? total - s0 : len;
+        // zero-padded so the segments sort by name
+        char num[24], idx[48], path[4096];
+        int nl = snprintf(num, sizeof num, "%llu", (unsigned long long)k);
+        int pad = width > nl ? width - nl : 0;
+        memset(idx, '0', (size_t)pad);
+        memcpy(idx + pad, num, (size_t)nl + 1);
+        sweep_path(path, sizeof path, argv[3], idx);
+        FILE *fout = open_output_with_header(path, in.sample_rate, n * 2);
+        copy_range(fileno(fin), (off_t)in.data_offset + (off_t)(s0 * 2), fileno(fout), 44, n * 2);
+        if (fclose(fout) != 0) die("fclose of output failed");
+    }
+    fclose(fin);
+    return 0;
+}
+
+/*
+Mixer. Every input is read one block at a time, in step, and accumulated
+into a single float block: acc[i] += g * x[i]. Only the sum is converted
+back with float_to_s16(), once per output sample, however many inputs
+there are. The accumulate loop runs over a whole block with a fixed trip
+count, so it vectorizes (and fuses into FMA where the target has it);
+with a handful of arithmetic instructions per 2 bytes read, the mix is
+limited by how fast the inputs stream in, not by the adds.
+
+Inputs may have different lengths and start offsets; outside its own
+span an input contributes nothing (it is zero-padded).
+*/
+typedef struct {
+    FILE    *f;
+    float    g;
+    uint64_t off;       // first output sample this input lands on
+    uint64_t len;       // samples
+} mix_input_t;
+
+// s16_to_float() without the branch: -32768 maps to -1.0, which is also
+// what -32767 gives, so an integer max (one vector instruction) does it
+static void mix_accum(float *restrict acc, const int16_t *restrict x, float g) {
+    for (size_t i = 0; i < BLOCK_SAMPLES; i++) {
+        int32_t v = x[i] < -32767 ? -32767 : x[i];
+        acc[i] += g * ((float)v / 32767.0f);
+    }
+}
+
+static int run_mix(int argc, char **argv) {
+    // mix <out.wav> (<in.wav> <gain[@offset]>)+
+    if (argc < 5 || (argc - 3) % 2 != 0) usage();
+    int nin = (argc - 3) / 2;
+    mix_input_t *ins = calloc((size_t)nin, sizeof *ins);
+    if (!ins) die("out of memory");
+
+    uint32_t sample_rate = 0;
+    uint64_t total = 0;
+    for (int k = 0; k < nin; k++) {
+        const char *path = argv[3 + 2 * k];
+        const char *gs = argv[4 + 2 * k];
+        ins[k].f = fopen(path, "rb");
+        if (!ins[k].f) die("Could not open input file");
+        wav_info_t in = read_wav_header(ins[k].f);
+        if (k == 0) sample_rate = in.sample_rate;
+        else if (in.sample_rate != sample_rate) die("mix: inputs have different sample rates");
+        if (fseek(ins[k].f, in.data_offset, SEEK_SET) != 0) die("fseek to data failed");
+
+        char *end;
+        ins[k].g = (float)strtod(gs, &end);
+        if (*end == '@') {
+            wav_pos_t p;
+            if (parse_pos(end + 1, &p) != 0) die("bad offset (use samples, <x>s or <x>ms)");
+            ins[k].off = pos_samples(&p, sample_rate);
+        } else if (*end != '\0') {
+            die("bad gain (use <gain> or <gain>@<offset>)");
+        }
+        ins[k].len = in.data_bytes / 2;
+        if (ins[k].off + ins[k].len > total) total = ins[k].off + ins[k].len;
+    }
+    if (total * 2 > 0xFFFFFFFFu - 36) die("output larger than a WAV file can describe (4 GB)");
+
+    FILE *fout = fopen(argv[2], "wb");
+    if (!fout) die("Could not open output file");
+    write_wav_header_pcm16_mono(fout, sample_rate, (uint32_t)(total * 2));
+
+    float   acc[BLOCK_SAMPLES];
+    int16_t ibuf[BLOCK_SAMPLES];
+    for (uint64_t b0 = 0; b0 < total; b0 += BLOCK_SAMPLES) {
+        size_t n = total - b0 < BLOCK_SAMPLES ? (size_t)(total - b0) : BLOCK_SAMPLES;
+        memset(acc, 0, sizeof acc);
+        for (int k = 0; k < nin; k++) {
+            // the part of this block the input covers
+            uint64_t s0 = ins[k].off > b0 ? ins[k].off : b0;
+            uint64_t s1 = ins[k].off + ins[k].len < b0 + n ? ins[k].off + ins[k].len : b0 + n;
+            if (s0 >= s1) continue;
+            size_t at = (size_t)(s0 - b0), cnt = (size_t)(s1 - s0);
+            // partial block: zero around the samples that are there
+            if (at > 0 || cnt < BLOCK_SAMPLES) memset(ibuf, 0, sizeof ibuf);
+            read_s16_block(ins[k].f, ibuf + at, cnt);
+            mix_accum(acc, ibuf, ins[k].g);
+        }
+        float_to_s16_block(acc, ibuf, n);
+        write_s16_block(fout, ibuf, n);
+    }
+
+    for (int k = 0; k < nin; k++) fclose(ins[k].f);
+    if (fclose(fout) != 0) die("fclose of output failed");
+    free(ins);
+    return 0;
+}
+
+/*
+Feedback delay network reverb.
+
+8 or 16 delay lines feed back into each other through an orthogonal
+(Hadamard) matrix; each line has a gain that sets its decay to the
+requested RT60 and a one-pole low-pass (lpf_coef() again) that makes the
+highs die away faster, as they do in a real room.
+
+All lines live in one power-of-two sized arena, one equal power-of-two
+segment per line, so a position wraps with a mask. Because every delay is
+longer than FDN_BLOCK samples, the next FDN_BLOCK outputs of every line
+were written at least one block ago: the network can read a whole block
+of all lines at once, run the damping and matrix on it, and write the
+block back. Inside the block the state is laid out [sample][line], so the
+per-sample work is a handful of fixed 16-wide loops over the lines, which
+compile to straight vector code. With 8 lines the upper 8 lanes are a
+second, unused network that stays silent.
+*/
+#define FDN_LANES 16
+#define FDN_BLOCK 64
+
+typedef struct {
+    int      lines;
+    float   *arena;
+    size_t   seg;               // samples per line (power of two)
+    size_t   mask;
+    size_t   len[FDN_LANES];
+    float    g[FDN_LANES];      // decay per trip round the loop, times 1/sqrt(lines)
+    float    inj[FDN_LANES];    // input gain into each line
+    float    outg[FDN_LANES];   // output tap gain of each line
+    float    damp_a;
+    float    damp_y[FDN_LANES];
+    uint64_t t;
+} fdn_t;
+
+static int is_prime(size_t n) {
+    if (n < 2) return 0;
+    for (size_t d = 2; d * d <= n; d++) if (n % d == 0) return 0;
+    return 1;
+}
+
+static void fdn_init(fdn_t *r, int lines, double rt60, double damp_hz, uint32_t sample_rate) {
+    memset(r, 0, sizeof *r);
+    r->lines = lines;
+    // prime lengths spread geometrically over 30..90 ms: no common factors,
+    // so the echoes of the different lines never line up
+    size_t maxlen = 0;
+    for (int i = 0; i < lines; i++) {
+        double ms = 30.0 * pow(3.0, (double)i / (double)(lines - 1));
+        size_t n = (size_t)(ms * 0.001 * (double)sample_rate);
+        if (n < FDN_BLOCK) n = FDN_BLOCK;
+        while (!is_prime(n)) n++;
+        r->len[i] = n;
+        if (n > maxlen) maxlen = n;
+    }
+    r->seg = pow2_at_least(maxlen + FDN_BLOCK);
+    r->mask = r->seg - 1;
+    r->arena = calloc((size_t)FDN_LANES * r->seg, sizeof *r->arena);
+    if (!r->arena) die("out of memory");
+
+    double norm = 1.0 / sqrt((double)lines);
+    for (int i = 0; i < lines; i++) {
+        // 60 dB down after rt60 seconds: g^(rt60*fs/len) = 10^-3
+        double g = pow(10.0, -3.0 * (double)r->len[i] / (rt60 * (double)sample_rate));
+        r->g[i] = (float)(g * norm);
+        r->inj[i] = (float)norm;
+        r->outg[i] = (float)((i & 1 ? -norm : norm));
+    }
+    r->damp_a = lpf_coef(damp_hz, sample_rate);
+}
+
+// in-place Hadamard transform over the lanes; 3 stages for 8 lines, 4 for 16
+static void fdn_hadamard(float *x, int lines) {
+    for (int h = 1; h < lines; h <<= 1) {
+        float y[FDN_LANES];
+        for (int i = 0; i < FDN_LANES; i++) {
+            int lo = i & ~h, hi = i | h;
+            y[i] = (i & h) ? x[lo] - x[hi] : x[lo] + x[hi];
+        }
+        memcpy(x, y, sizeof y);
+    }
+}
+
+// one FDN_BLOCK of input -> wet output
+static void fdn_block(fdn_t *r, const float *in, float *wet) {
+    float s[FDN_BLOCK][FDN_LANES];
+    memset(s, 0, sizeof s);
+
+    // read: the block each line outputs now was written len samples ago
+    for (int i = 0; i < r->lines; i++) {
+        const float *line = r->arena + (size_t)i * r->seg;
+        size_t rd = (size_t)(r->t - r->len[i]) & r->mask;
+        for (size_t b = 0; b < FDN_BLOCK; b++) s[b][i] = line[(rd + b) & r->mask];
+    }
+
+    float y[FDN_LANES];
+    memcpy(y, r->damp_y, sizeof y);
+    const float a = r->damp_a;
+    for (size_t b = 0; b < FDN_BLOCK; b++) {
+        float *v = s[b];
+        float w = 0.0f;
+        for (int i = 0; i < FDN_LANES; i++) {
+            y[i] = y[i] + a * (v[i] - y[i]);     // damping
+            v[i] = y[i];
+            w += r->outg[i] * v[i];
+        }
+        wet[b] = w;
+        fdn_hadamard(v, r->lines);
+        for (int i = 0; i < FDN_LANES; i++) v[i] = r->g[i] * v[i] + r->inj[i] * in[b];
+    }
+    memcpy(r->damp_y, y, sizeof y);
+
+    // write the block back at the current position
+    for (int i = 0; i < r->lines; i++) {
+        float *line = r->arena + (size_t)i * r->seg;
+        size_t wr = (size_t)r->t & r->mask;
+        for (size_t b = 0; b < FDN_BLOCK; b++) line[(wr + b) & r->mask] = s[b][i];
+    }
+    r->t += FDN_BLOCK;
+}
+
+static int run_reverb(int argc, char **argv) {
+    // reverb <in> <out> <rt60_s> [damp_hz] [wet] [lines]
+    if (argc < 5 || argc > 8) usage();
+    double rt60 = strtod(argv[4], NULL);
+    double damp_hz = argc > 5 ? strtod(argv[5], NULL) : 6000.0;
+    double wet_mix = argc > 6 ? strtod(argv[6], NULL) : 0.3;
+    int lines = argc > 7 ? (int)strtol(argv[7], NULL, 10) : 16;
+    if (rt60 <= 0.0) die("rt60 must be > 0");
+    if (damp_hz <= 0.0) die("damp_hz must be > 0");
+    if (wet_mix < 0.0 || wet_mix > 1.0) die("wet must be in 0..1");
+    if (lines != 8 && lines != 16) die("lines must be 8 or 16");
+
+    FILE *fin = fopen(argv[2], "rb");
+    if (!fin) die("Could not open input file");
+    wav_info_t in = read_wav_header(fin);
+    if (fseek(fin, in.data_offset, SEEK_SET) != 0) die("fseek to data failed");
+
+    // the output keeps going for rt60 after the input ends, so the tail
+    // is not cut off
+    uint64_t n_in = in.data_bytes / 2;
+    uint64_t n_out = n_in + (uint64_t)llround(rt60 * (double)in.sample_rate);
+    if (n_out * 2 > 0xFFFFFFFFu - 36) die("output larger than a WAV file can describe (4 GB)");
+
+    FILE *fout = fopen(argv[3], "wb");
+    if (!fout) die("Could not open output file");
+    write_wav_header_pcm16_mono(fout, in.sample_rate, (uint32_t)(n_out * 2));
+
+    fdn_t r;
+    fdn_init(&r, lines, rt60, damp_hz, in.sample_rate);
+
+    int16_t ibuf[BLOCK_SAMPLES];
+    float   x[BLOCK_SAMPLES], w[BLOCK_SAMPLES];
+    const float dry_g = (float)(1.0 - wet_mix), wet_g = (float)wet_mix;
+    for (uint64_t pos = 0; pos < n_out; pos += BLOCK_SAMPLES) {
+        size_t n = n_out - pos < BLOCK_SAMPLES ? (size_t)(n_out - pos) : BLOCK_SAMPLES;
+        size_t have = pos >= n_in ? 0 : (n_in - pos < n ? (size_t)(n_in - pos) : n);
+        read_s16_block(fin, ibuf, have);
+        s16_to_float_block(ibuf, x, have);
+        // past the input (and past n, up to the FDN block) the input is silence
+        memset(x + have, 0, (BLOCK_SAMPLES - have) * sizeof *x);
+        for (size_t b = 0; b < n; b += FDN_BLOCK) fdn_block(&r, x + b, w + b);
+        for (size_t i = 0; i < n; i++) x[i] = dry_g * x[i] + wet_g * w[i];
+        float_to_s16_block(x, ibuf, n);
+        write_s16_block(fout, ibuf, n);
+    }
+
+    free(r.arena);
+    fclose(fin);
+    if (fclose(fout) != 0) die("fclose of output failed");
+    return 0;
+}
+
+/*
+Time stretch.
+
+Both methods cut the input into overlapping frames and lay them down again
+at a different spacing: a frame is taken every ha input samples and
+overlap-added every hs output samples, with ha = hs / factor.
+
+WSOLA (waveform similarity overlap-add) slides each frame's input position
+by up to +-tol samples to where the waveform best matches what the
+previous frame would have continued into. The output is made of unaltered
+pieces of the input, which suits speech. The phase vocoder instead takes
+the FFT of each frame and advances each bin's phase by the bin's measured
+frequency times hs, so steady tones stay coherent whatever the spacing,
+which suits music. Above the fast setting the bins around each spectral
+peak are locked to the peak's phase (Laroche and Dolson's identity phase
+locking), which removes most of the vocoder's phasiness.
+
+Everything streams. The input is held in a window just large enough for
+one frame and its search range, and the output in one frame of
+overlap-add accumulator, so memory does not grow with the file.
+*/
+typedef enum { STRETCH_WSOLA, STRETCH_PV } stretch_method_t;
+
+typedef struct {
+    // input window: in[i] is input sample in_base + i (0 outside the file)
+    FILE    *fin;
+    uint64_t total;
+    float   *in;
+    size_t   in_cap, in_len;
+    int64_t  in_base;
+
+    stretch_method_t method;
+    double   ha;            // analysis hop, fractional
+    size_t   n, hs;         // frame length, synthesis hop
+    uint64_t k;             // next frame
+    uint64_t n_out;
+    float   *win, *frame, *acc;
+    float    ola_gain;
+
+    // output ready to hand out: the finished head of the accumulator
+    float   *q;
+    size_t   q_pos, q_len;
+
+    // WSOLA
+    int64_t  prev;          // input start of the previous frame
+    int64_t  tol, step;
+
+    // phase vocoder
+    fft_plan_t *plan;
+    float   *zr, *zi, *xr, *xi, *mag, *pa, *pa_prev, *ps;
+    uint32_t *peaks;
+    int      lock;
+    int64_t  a_prev;
+} stretch_t;
+
+// sum of a[i]*b[i], n a multiple of 8; eight partial sums so it vectorizes
+static float dot8(const float *restrict a, const float *restrict b, size_t n) {
+    float acc[8] = { 0 };
+    for (size_t i = 0; i < n; i += 8) {
+        for (int j = 0; j < 8; j++) acc[j] += a[i + j] * b[i + j];
+    }
+    return ((acc[0] + acc[1]) + (acc[2] + acc[3])) + ((acc[4] + acc[5]) + (acc[6] + acc[7]));
+}
+
+// the zero-padded input from pos on; the file is read sequentially, so
+// successive calls must continue where the last one stopped
+static void stretch_gen(stretch_t *st, int64_t pos, float *dst, size_t count) {
+    int16_t tmp[BLOCK_SAMPLES];
+    while (count > 0) {
+        if (pos < 0 || (uint64_t)pos >= st->total) {
+            size_t z = count;
+            if (pos < 0 && (uint64_t)-pos < z) z = (size_t)-pos;
+            memset(dst, 0, z * sizeof *dst);
+            dst += z;
+            pos += (int64_t)z;
+            count -= z;
+            continue;
+        }
+        size_t r = count < BLOCK_SAMPLES ? count : BLOCK_SAMPLES;
+        if (st->total - (uint64_t)pos < r) r = (size_t)(st->total - (uint64_t)pos);
+        read_s16_block(st->fin, tmp, r);
+        s16_to_float_block(tmp, dst, r);
+        dst += r;
+        pos += (int64_t)r;
+        count -= r;
+    }
+}
+
+// input [lo, lo+count) with in[0] at lo; lo never moves backwards
+static const float *stretch_input(stretch_t *st, int64_t lo, size_t count) {
+    if (lo < st->in_base) die("stretch: input window moved backwards");
+    if (count > st->in_cap) die("stretch: input window too small");
+    uint64_t drop = (uint64_t)(lo - st->in_base);
+    if (drop > st->in_len) drop = st->in_len;
+    memmove(st->in, st->in + drop, (st->in_len - (size_t)drop) * sizeof *st->in);
+    st->in_base += (int64_t)drop;
+    st->in_len -= (size_t)drop;
+    // compressing hard, the next frame can start past everything read so far
+    while (st->in_base < lo) {
+        uint64_t gap = (uint64_t)(lo - st->in_base);
+        size_t s = gap < st->in_cap ? (size_t)gap : st->in_cap;
+        stretch_gen(st, st->in_base, st->in, s);
+        st->in_base += (int64_t)s;
+    }
+    int64_t end = st->in_base + (int64_t)st->in_len;
+    if (lo + (int64_t)count > end) {
+        size_t more = (size_t)(lo + (int64_t)count - end);
+        stretch_gen(st, end, st->in + st->in_len, more);
+        st->in_len += more;
+    }
+    return st->in;
+}
+
+// quality: 0 fast, 1 normal, 2 best
+static void stretch_init(stretch_t *st, FILE *fin, uint64_t total, uint32_t sample_rate,
+                         double factor, stretch_method_t method, int quality) {
+    memset(st, 0, sizeof *st);
+    st->fin = fin;
+    st->total = total;
+    st->method = method;
+    st->n_out = (uint64_t)llround((double)total * factor);
+
+    if (method == STRETCH_WSOLA) {
+        // ~20 ms frames (a pitch period or two of speech), a multiple of 16
+        // so the correlation over half a frame runs in whole groups of 8
+        size_t n = ((size_t)(sample_rate / 50) + 15) & ~(size_t)15;
+        if (n < 64) n = 64;
+        st->n = n;
+        st->hs = n / 2;
+        st->tol = (int64_t)(quality == 0 ? n / 4 : quality == 1 ? n / 2 : 3 * n / 4);
+        st->step = quality == 0 ? 4 : quality == 1 ? 2 : 1;
+        st->ola_gain = 1.0f;    // Hann windows at half overlap sum to 1
+    } else {
+        size_t n = pow2_at_least(quality == 0 ? sample_rate / 48 : sample_rate / 24);
+        if (n < 256) n = 256;
+        st->n = n;
+        st->hs = quality == 2 ? n / 8 : n / 4;
+        st->lock = quality > 0;
+        // analysis and synthesis windows: Hann^2 overlapped at hs sums to 3n/(8 hs)
+        st->ola_gain = (float)(8.0 * (double)st->hs / (3.0 * (double)n));
+        size_t bins = n / 2 + 1;
+        st->plan = fft_plan_new(n);
+        st->zr = malloc(n / 2 * sizeof *st->zr);
+        st->zi = malloc(n / 2 * sizeof *st->zi);
+        st->xr = malloc(bins * sizeof *st->xr);
+        st->xi = malloc(bins * sizeof *st->xi);
+        st->mag = malloc(bins * sizeof *st->mag);
+        st->pa = malloc(bins * sizeof *st->pa);
+        st->pa_prev = malloc(bins * sizeof *st->pa_prev);
+        st->ps = malloc(bins * sizeof *st->ps);
+        st->peaks = malloc(bins * sizeof *st->peaks);
+        if (!st->zr || !st->zi || !st->xr || !st->xi || !st->mag || !st->pa || !st->pa_prev ||
+            !st->ps || !st->peaks) die("out of memory");
+    }
+    st->ha = (double)st->hs / factor;
+
+    st->in_cap = 2 * st->n + 2 * (size_t)st->tol + (size_t)ceil(st->ha) + 16;
+    st->in_base = -(int64_t)(st->n / 2) - st->tol;
+    st->in = malloc(st->in_cap * sizeof *st->in);
+    st->win = malloc(st->n * sizeof *st->win);
+    st->frame = malloc(st->n * sizeof *st->frame);
+    st->acc = calloc(st->n, sizeof *st->acc);
+    st->q = malloc(st->hs * sizeof *st->q);
+    if (!st->in || !st->win || !st->frame || !st->acc || !st->q) die("out of memory");
+    const double two_pi = 2.0 * acos(-1.0);
+    for (size_t i = 0; i < st->n; i++) {
+        st->win[i] = (float)(0.5 - 0.5 * cos(two_pi * (double)i / (double)st->n));
+    }
+}
+
+static void stretch_free(stretch_t *st) {
+    fft_plan_free(st->plan);
+    free(st->zr); free(st->zi); free(st->xr); free(st->xi);
+    free(st->mag); free(st->pa); free(st->pa_prev); free(st->ps); free(st->peaks);
+    free(st->in); free(st->win); free(st->frame); free(st->acc); free(st->q);
+}
+
+/* Offset in [-tol, tol] at which hs samples of x best match ref (largest
+   cross-correlation). x[0] is the nominal position. With step > 1 the
+   search is coarse first and then refined around the coarse winner. */
+static int64_t wsola_search(const float *x, const float *ref, size_t hs,
+                            int64_t tol, int64_t step) {
+    int64_t best = 0;
+    float best_cc = -INFINITY;
+    for (int64_t d = -tol; d <= tol; d += step) {
+        float cc = dot8(x + d, ref, hs);
+        if (cc > best_cc) { best_cc = cc; best = d; }
+    }
+    if (step > 1) {
+        int64_t lo = best - step + 1 < -tol ? -tol : best - step + 1;
+        int64_t hi = best + step - 1 > tol ? tol : best + step - 1;
+        int64_t centre = best;
+        for (int64_t d = lo; d <= hi; d++) {
+            if (d == centre) continue;
+            float cc = dot8(x + d, ref, hs);
+            if (cc > best_cc) { best_cc = cc; best = d; }
+        }
+    }
+    return best;
+}
+
+static float wrap_phase(float p) {
+    const float two_pi = 6.28318530717958647692f;
+    return p - two_pi * rintf(p / two_pi);
+}
+
+static void pv_frame(stretch_t *st, const float *x, int64_t a) {
+    const size_t n = st->n, bins = n / 2 + 1;
+    const float two_pi = 6.28318530717958647692f;
+    for (size_t i = 0; i < n; i++) st->frame[i] = st->win[i] * x[i];
+    fft_real(st->plan, st->frame, st->zr, st->zi, st->xr, st->xi);
+    for (size_t b = 0; b < bins; b++) {
+        st->mag[b] = hypotf(st->xr[b], st->xi[b]);
+        st->pa[b] = atan2f(st->xi[b], st->xr[b]);
+    }
+
+    if (st->k == 0) {
+        memcpy(st->ps, st->pa, bins * sizeof *st->ps);
+    } else {
+        // bin b advances omega*dha per hop; the wrapped deviation from that
+        // is the bin's frequency offset, and the output phase moves on by
+        // the measured frequency times hs
+        const float dha = (float)(a - st->a_prev);
+        const float hs = (float)st->hs;
+        for (size_t b = 0; b < bins; b++) {
+            float omega = two_pi * (float)b / (float)n;
+            float dev = wrap_phase(st->pa[b] - st->pa_prev[b] - omega * dha);
+            st->ps[b] = wrap_phase(st->ps[b] + (omega + dev / dha) * hs);
+        }
+        if (st->lock) {
+            size_t np = 0;
+            for (size_t b = 2; b + 2 < bins; b++) {
+                float m = st->mag[b];
+                if (m > st->mag[b - 1] && m > st->mag[b - 2] && m >= st->mag[b + 1] &&
+                    m >= st->mag[b + 2]) st->peaks[np++] = (uint32_t)b;
+            }
+            // every bin keeps its phase relative to the nearest peak
+            size_t p = 0;
+            for (size_t b = 0; np > 0 && b < bins; b++) {
+                while (p + 1 < np && 2 * b > (size_t)st->peaks[p] + st->peaks[p + 1]) p++;
+                size_t pk = st->peaks[p];
+                if (b != pk) st->ps[b] = st->ps[pk] + st->pa[b] - st->pa[pk];
+            }
+        }
+    }
+
+    for (size_t b = 0; b < bins; b++) {
+        st->xr[b] = st->mag[b] * cosf(st->ps[b]);
+        st->xi[b] = st->mag[b] * sinf(st->ps[b]);
+    }
+    fft_real_inverse(st->plan, st->xr, st->xi, st->zr, st->zi, st->frame);
+    const float g = st->ola_gain;
+    for (size_t i = 0; i < n; i++) st->acc[i] += g * st->win[i] * st->frame[i];
+    memcpy(st->pa_prev, st->pa, bins * sizeof *st->pa_prev);
+    st->a_prev = a;
+}
+
+// add frame k to the accumulator and queue the hs samples it completes
+static void stretch_frame(stretch_t *st) {
+    const size_t n = st->n, hs = st->hs;
+    const int64_t c = (int64_t)(n / 2);
+    int64_t a = llround((double)st->k * st->ha) - c;   // nominal input start
+
+    if (st->method == STRETCH_WSOLA) {
+        // where the previous frame's input would have carried on
+        int64_t target = st->k > 0 ? st->prev + (int64_t)hs : a;
+        int64_t lo = a - st->tol < target ? a - st->tol : target;
+        int64_t hi = a + st->tol + (int64_t)n;
+        if (target + (int64_t)hs > hi) hi = target + (int64_t)hs;
+        const float *x = stretch_input(st, lo, (size_t)(hi - lo));
+        int64_t start = a;
+        if (st->k > 0) start += wsola_search(x + (a - lo), x + (target - lo), hs, st->tol, st->step);
+        const float *f = x + (start - lo);
+        for (size_t i = 0; i < n; i++) st->acc[i] += st->win[i] * f[i];
+        st->prev = start;
+    } else {
+        pv_frame(st, stretch_input(st, a, n), a);
+    }
+
+    // acc[0..hs) holds output samples s .. s+hs-1 and no later frame reaches them
+    int64_t s = (int64_t)(st->k * hs) - c;
+    st->q_pos = st->q_len = 0;
+    for (size_t i = 0; i < hs; i++) {
+        int64_t pos = s + (int64_t)i;
+        if (pos >= 0 && (uint64_t)pos < st->n_out) st->q[st->q_len++] = st->acc[i];
+    }
+    memmove(st->acc, st->acc + hs, (n - hs) * sizeof *st->acc);
+    memset(st->acc + n - hs, 0, hs * sizeof *st->acc);
+    st->k++;
+}
+
+// up to max output samples; 0 once the whole output has been produced
+static size_t stretch_pull(stretch_t *st, float *out, size_t max) {
+    size_t got = 0;
+    while (got < max) {
+        if (st->q_pos == st->q_len) {
+            int64_t s = (int64_t)(st->k * st->hs) - (int64_t)(st->n / 2);
+            if (s >= 0 && (uint64_t)s >= st->n_out) break;
+            stretch_frame(st);
+            continue;
+        }
+        size_t c = st->q_len - st->q_pos;
+        if (c > max - got) c = max - got;
+        memcpy(out + got, st->q + st->q_pos, c * sizeof *out);
+        got += c;
+        st->q_pos += c;
+    }
+    return got;
+}
+
+static int parse_quality(const char *s) {
+    if (strcmp(s, "fast") == 0) return 0;
+    if (strcmp(s, "normal") == 0) return 1;
+    if (strcmp(s, "best") == 0) return 2;
+    die("quality must be fast, normal or best");
+    return 1;
+}
+
+static int run_stretch(int argc, char **argv) {
+    // stretch <in> <out> <factor> [wsola|pv] [fast|normal|best]
+    if (argc < 5 || argc > 7) usage();
+    double factor = strtod(argv[4], NULL);
+    if (!(factor >= 0.1 && factor <= 10.0)) die("factor must be in 0.1..10");
+    stretch_method_t method = STRETCH_WSOLA;
+    if (argc > 5) {
+        if (strcmp(argv[5], "wsola") == 0) method = STRETCH_WSOLA;
+        else if (strcmp(argv[5], "pv") == 0) method = STRETCH_PV;
+        else die("method must be wsola or pv");
+    }
+    int quality = argc > 6 ? parse_quality(argv[6]) : 1;
+
+    FILE *fin = fopen(argv[2], "rb");
+    if (!fin) die("Could not open input file");
+    wav_info_t in = read_wav_header(fin);
+    if (fseek(fin, in.data_offset, SEEK_SET) != 0) die("fseek to data failed");
+
+    stretch_t st;
+    stretch_init(&st, fin, in.data_bytes / 2, in.sample_rate, factor, method, quality);
+    if (st.n_out * 2 > 0xFFFFFFFFu - 36) die("output larger than a WAV file can describe (4 GB)");
+
+    FILE *fout = fopen(argv[3], "wb");
+    if (!fout) die("Could not open output file");
+    write_wav_header_pcm16_mono(fout, in.sample_rate, (uint32_t)(st.n_out * 2));
+
+    float   buf[BLOCK_SAMPLES];
+    int16_t obuf[BLOCK_SAMPLES];
+    uint64_t t0 = now_ns();
+    size_t got;
+    while ((got = stretch_pull(&st, buf, BLOCK_SAMPLES)) > 0) {
+        float_to_s16_block(buf, obuf, got);
+        write_s16_block(fout, obuf, got);
+    }
+    uint64_t t1 = now_ns();
+
+    double secs = (double)st.total / (double)in.sample_rate;
+    double wall = (double)(t1 - t0) * 1e-9;
+    fprintf(report(), "stretched %.1f s -> %.1f s (%s, frame %zu, hop %zu)\n",
+            secs, (double)st.n_out / (double)in.sample_rate,
+            method == STRETCH_WSOLA ? "wsola" : "pv", st.n, st.hs);
+    fprintf(report(), "processed in %.3f s (%.0fx real time)\n", wall, wall > 0.0 ? secs / wall : 0.0);
+
+    stretch_free(&st);
+    fclose(fin);
+    if (fclose(fout) != 0) die("fclose of output failed");
+    return 0;
+}
+
+/*
+Pitch shift: stretch by r = 2^(semitones/12), then resample by r, which
+brings the duration back and moves every frequency by r.
+
+The resampler is a polyphase windowed sinc: RS_PHASES fractional
+positions, each a row of taps (8, 16 or 32 by quality, always a multiple
+of 8 so each output sample is one dot8()). When shifting up the cutoff
+drops to 1/r of Nyquist so nothing aliases. The stretcher's output is
+pulled a block at a time into a window like the stretcher's own input
+window, so the whole chain streams in bounded memory. Instances share
+nothing, so a batch parallelizes across files (one process per file, or
+the serve workers).
+*/
+#define RS_PHASES 256
+
+typedef struct {
+    stretch_t st;
+    double    ratio;
+    size_t    taps;
+    float    *h;            // RS_PHASES rows of taps
+    float    *in;           // stretched samples [in_base, in_base + in_len)
+    size_t    in_cap, in_len;
+    int64_t   in_base;
+    uint64_t  j, n_out;     // next output sample, output length
+} pitch_t;
+
+static void pitch_init(pitch_t *ps, FILE *fin, uint64_t total, uint32_t sample_rate,
+                       double semitones, stretch_method_t method, int quality) {
+    memset(ps, 0, sizeof *ps);
+    ps->ratio = pow(2.0, semitones / 12.0);
+    stretch_init(&ps->st, fin, total, sample_rate, ps->ratio, method, quality);
+    ps->n_out = total;
+    ps->taps = quality == 0 ? 8 : quality == 1 ? 16 : 32;
+
+    const double pi = acos(-1.0), beta = 6.0;
+    const double fc = 0.95 * (ps->ratio > 1.0 ? 1.0 / ps->ratio : 1.0);
+    const size_t t = ps->taps;
+    ps->h = malloc(RS_PHASES * t * sizeof *ps->h);
+    if (!ps->h) die("out of memory");
+    for (size_t p = 0; p < RS_PHASES; p++) {
+        double frac = (double)p / RS_PHASES, sum = 0.0;
+        double row[32];
+        for (size_t k = 0; k < t; k++) {
+            // distance from the output position to input tap k
+            double d = (double)k - (double)(t / 2 - 1) - frac;
+            double x = fc * d;
+            double sinc = fabs(x) < 1e-12 ? 1.0 : sin(pi * x) / (pi * x);
+            double r = d / (double)(t / 2);
+            double w = fabs(r) < 1.0 ? bessel_i0(beta * sqrt(1.0 - r * r)) / bessel_i0(beta) : 0.0;
+            row[k] = sinc * w;
+            sum += row[k];
+        }
+        for (size_t k = 0; k < t; k++) ps->h[p * t + k] = (float)(row[k] / sum);
+    }
+
+    ps->in_cap = (size_t)ceil(BLOCK_SAMPLES * ps->ratio) + t + 16;
+    ps->in = malloc(ps->in_cap * sizeof *ps->in);
+    if (!ps->in) die("out of memory");
+    // the taps left of sample 0 read silence
+    ps->in_len = t / 2 - 1;
+    ps->in_base = -(int64_t)ps->in_len;
+    memset(ps->in, 0, ps->in_len * sizeof *ps->in);
+}
+
+static void pitch_free(pitch_t *ps) {
+    stretch_free(&ps->st);
+    free(ps->h);
+    free(ps->in);
+}
+
+// up to max output samples; 0 at the end
+static size_t pitch_pull(pitch_t *ps, float *out, size_t max) {
+    if (ps->j >= ps->n_out) return 0;
+    if (max > BLOCK_SAMPLES) max = BLOCK_SAMPLES;
+    if (ps->n_out - ps->j < max) max = (size_t)(ps->n_out - ps->j);
+    const size_t t = ps->taps;
+    const int64_t half = (int64_t)(t / 2) - 1;
+
+    // stretched samples this block reads: drop what is behind, pull what is ahead
+    int64_t lo = (int64_t)floor((double)ps->j * ps->ratio) - half;
+    int64_t hi = (int64_t)floor((double)(ps->j + max - 1) * ps->ratio) - half + (int64_t)t;
+    size_t drop = (size_t)(lo - ps->in_base);
+    if (drop > ps->in_len) drop = ps->in_len;
+    memmove(ps->in, ps->in + drop, (ps->in_len - drop) * sizeof *ps->in);
+    ps->in_base += (int64_t)drop;
+    ps->in_len -= drop;
+    while (ps->in_base + (int64_t)ps->in_len < hi) {
+        size_t want = (size_t)(hi - ps->in_base) - ps->in_len;
+        size_t got = stretch_pull(&ps->st, ps->in + ps->in_len, want);
+        if (got == 0) {
+            // past the end of the stretched signal: silence
+            memset(ps->in + ps->in_len, 0, want * sizeof *ps->in);
+            got = want;
+        }
+        ps->in_len += got;
+    }
+
+    for (size_t i = 0; i < max; i++) {
+        double x = (double)(ps->j + i) * ps->ratio;
+        double fl = floor(x);
+        size_t p = (size_t)((x - fl) * RS_PHASES + 0.5);
+        int64_t k0 = (int64_t)fl - half;
+        if (p == RS_PHASES) { p = 0; k0++; }
+        out[i] = dot8(ps->h + p * t, ps->in + (k0 - ps->in_base), t);
+    }
+    ps->j += max;
+    return max;
+}
+
+static int run_pitch(int argc, char **argv) {
+    // pitch <in> <out> <semitones> [wsola|pv] [fast|normal|best]
+    if (argc < 5 || argc > 7) usage();
+    double semitones = strtod(argv[4], NULL);
+    if (!(semitones >= -24.0 && semitones <= 24.0)) die("semitones must be in -24..24");
+    stretch_method_t method = STRETCH_WSOLA;
+    if (argc > 5) {
+        if (strcmp(argv[5], "wsola") == 0) method = STRETCH_WSOLA;
+        else if (strcmp(argv[5], "pv") == 0) method = STRETCH_PV;
+        else die("method must be wsola or pv");
+    }
+    int quality = argc > 6 ? parse_quality(argv[6]) : 1;
+
+    FILE *fin = fopen(argv[2], "rb");
+    if (!fin) die("Could not open input file");
+    wav_info_t in = read_wav_header(fin);
+    if (fseek(fin, in.data_offset, SEEK_SET) != 0) die("fseek to data failed");
+
+    pitch_t ps;
+    pitch_init(&ps, fin, in.data_bytes / 2, in.sample_rate, semitones, method, quality);
+
+    FILE *fout = fopen(argv[3], "wb");
+    if (!fout) die("Could not open output file");
+    write_wav_header_pcm16_mono(fout, in.sample_rate, in.data_bytes);
+
+    float   buf[BLOCK_SAMPLES];
+    int16_t obuf[BLOCK_SAMPLES];
+    uint64_t t0 = now_ns();
+    size_t got;
+    while ((got = pitch_pull(&ps, buf, BLOCK_SAMPLES)) > 0) {
+        float_to_s16_block(buf, obuf, got);
+        write_s16_block(fout, obuf, got);
+    }
+    uint64_t t1 = now_ns();
+
+    double secs = (double)ps.n_out / (double)in.sample_rate;
+    double wall = (double)(t1 - t0) * 1e-9;
+    fprintf(report(), "shifted %.1f s by %+.2f semitones (ratio %.4f, %s, %zu taps)\n",
+            secs, semitones, ps.ratio, method == STRETCH_WSOLA ? "wsola" : "pv", ps.taps);
+    fprintf(report(), "processed in %.3f s (%.0fx real time)\n", wall, wall > 0.0 ? secs / wall : 0.0);
+
+    pitch_free(&ps);
+    fclose(fin);
+    if (fclose(fout) != 0) die("fclose of output failed");
+    return 0;
+}
+
+/*
+Impulse response from a swept-sine measurement.
+
+The recording y is the system's response to the sweep x, so Y = H X and
+the impulse response is h = IFFT(Y / X). Plain division blows up where
+the sweep has no energy (below its start, above its end), so Y is
+multiplied by a regularized inverse filter instead,
+
+  G = conj(X) / (|X|^2 + eps),  eps = DECONV_EPS * max |X|^2,
+
+which is 1/X inside the sweep's band and rolls off to 0 outside it. The
+FFT size is a power of two >= len(y) + len(x), so the circular result
+does not wrap onto itself: h[0..) is the linear impulse response (the
+position of its peak is the system latency) and negative times land at
+the end of the buffer.
+
+That is where an exponential sweep (wavgen expsweep) puts harmonic
+distortion: the k-th harmonic of the sweep is the sweep itself,
+T ln(k) / ln(f2/f1) seconds later, so its impulse response appears that
+much before t = 0. Given the sweep's f1 and f2, the IRs of harmonics
+2..N are cut out of the negative times, each up to where the previous
+one starts.
+
+The whole measurement is three real FFTs.
+*/
+#define DECONV_EPS      1e-5    // -50 dB re the sweep's strongest bin
+#define DECONV_MAX_HARM 16
+
+// n samples of an open input (at its data) as floats
+static void read_float_samples(FILE *f, float *x, size_t n) {
+    int16_t buf[BLOCK_SAMPLES];
+    for (size_t i = 0; i < n; i += BLOCK_SAMPLES) {
+        size_t k = n - i < BLOCK_SAMPLES ? n - i : BLOCK_SAMPLES;
+        read_s16_block(f, buf, k);
+        s16_to_float_block(buf, x + i, k);
+    }
+}
+
+static void write_ir(const char *path, uint32_t sample_rate, const float *h, size_t n, float scale) {
+    FILE *f = fopen(path, "wb");
+    if (!f) die("Could not open output file");
+    write_wav_header_pcm16_mono(f, sample_rate, (uint32_t)(n * 2));
+    float buf[BLOCK_SAMPLES];
+    int16_t obuf[BLOCK_SAMPLES];
+    for (size_t i = 0; i < n; i += BLOCK_SAMPLES) {
+        size_t k = n - i < BLOCK_SAMPLES ? n - i : BLOCK_SAMPLES;
+        memcpy(buf, h + i, k * sizeof *buf);
+        gain_block(buf, k, scale);
+        float_to_s16_block(buf, obuf, k);
+        write_s16_block(f, obuf, k);
+    }
+    if (fclose(f) != 0) die("fclose of output failed");
+}
+
+static float peak_abs(const float *x, size_t n, size_t *at) {
+    float pk = 0.0f;
+    *at = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (fabsf(x[i]) > pk) {
+            pk = fabsf(x[i]);
+            *at = i;
+        }
+    }
+    return pk;
+}
+
+static int run_deconvolve(int argc, char **argv) {
+    // deconvolve <recorded.wav> <sweep.wav> <out.wav> [ir_length] [harmonics f1 f2]
+    if (argc != 5 && argc != 6 && argc != 9) usage();
+
+    FILE *fy = fopen(argv[2], "rb");
+    if (!fy) die("Could not open input file");
+    wav_info_t iy = read_wav_header(fy);
+    FILE *fx = fopen(argv[3], "rb");
+    if (!fx) die("Could not open sweep file");
+    wav_info_t ix = read_wav_header(fx);
+    if (iy.sample_rate != ix.sample_rate) die("deconvolve: recording and sweep have different sample rates");
+    const uint32_t sr = iy.sample_rate;
+    size_t ny = iy.data_bytes / 2, nx = ix.data_bytes / 2;
+    if (nx == 0 || ny == 0) die("deconvolve: empty input");
+
+    size_t ir_len = sr;
+    if (argc > 5) {
+        wav_pos_t p;
+        if (parse_pos(argv[5], &p) != 0) die("bad IR length (use samples, <x>s or <x>ms)");
+        ir_len = (size_t)pos_samples(&p, sr);
+        if (ir_len == 0) die("IR length must be > 0");
+    }
+    int harmonics = 1;
+    double f1 = 0.0, f2 = 0.0;
+    if (argc == 9) {
+        harmonics = atoi(argv[6]);
+        f1 = strtod(argv[7], NULL);
+        f2 = strtod(argv[8], NULL);
+        if (harmonics < 2 || harmonics > DECONV_MAX_HARM) die("harmonics must be in 2..16");
+        if (!(f1 > 0.0 && f2 > f1)) die("need 0 < f1 < f2 (the sweep's start and end Hz)");
+        if ((double)harmonics >= f2 / f1) die("highest harmonic must be below f2/f1");
+    }
+
+    uint64_t t0 = now_ns();
+    size_t n = pow2_at_least(ny + nx);
+    size_t bins = n / 2 + 1;
+    if (ir_len > ny) ir_len = ny;
+    fft_plan_t *plan = fft_plan_new(n);
+    float *x = calloc(n, sizeof *x), *y = calloc(n, sizeof *y);
+    float *xr = malloc(bins * sizeof *xr), *xi = malloc(bins * sizeof *xi);
+    float *yr = malloc(bins * sizeof *yr), *yi = malloc(bins * sizeof *yi);
+    float *zr = malloc(n / 2 * sizeof *zr), *zi = malloc(n / 2 * sizeof *zi);
+    if (!x || !y || !xr || !xi || !yr || !yi || !zr || !zi) die("out of memory");
+
+    if (fseek(fy, iy.data_offset, SEEK_SET) != 0) die("fseek to data failed");
+    if (fseek(fx, ix.data_offset, SEEK_SET) != 0) die("fseek to data failed");
+    read_float_samples(fy, y, ny);
+    read_float_samples(fx, x, nx);
+    fclose(fy);
+    fclose(fx);
+
+    fft_real(plan, x, zr, zi, xr, xi);
+    fft_real(plan, y, zr, zi, yr, yi);
+    float pmax = 0.0f;
+    for (size_t k = 0; k < bins; k++) {
+        float p = xr[k] * xr[k] + xi[k] * xi[k];
+        pmax = p > pmax ? p : pmax;
+    }
+    if (pmax == 0.0f) die("deconvolve: the sweep is silent");
+    const float eps = (float)DECONV_EPS * pmax;
+    for (size_t k = 0; k < bins; k++) {
+        // Y * conj(X) / (|X|^2 + eps)
+        float inv = 1.0f / (xr[k] * xr[k] + xi[k] * xi[k] + eps);
+        float hr = (yr[k] * xr[k] + yi[k] * xi[k]) * inv;
+        float hi = (yi[k] * xr[k] - yr[k] * xi[k]) * inv;
+        yr[k] = hr;
+        yi[k] = hi;
+    }
+    float *h = y;
+    fft_real_inverse(plan, yr, yi, zr, zi, h);
+
+    // where each IR sits in h: the linear one at 0, harmonic k at -dt_k
+    size_t start[DECONV_MAX_HARM + 1], len[DECONV_MAX_HARM + 1];
+    start[1] = 0;
+    len[1] = ir_len;
+    double prev_dt = 0.0;
+    for (int k = 2; k <= harmonics; k++) {
+        double dt = (double)nx * log((double)k) / log(f2 / f1);
+        size_t at = (size_t)llround(dt);
+        start[k] = n - at;
+        size_t room = (size_t)(dt - prev_dt);
+        len[k] = room < ir_len ? room : ir_len;
+        if (len[k] == 0) die("harmonics too close together for this sweep; use fewer");
+        prev_dt = dt;
+    }
+
+    // one common scale for all outputs, only if one would clip
+    float pk[DECONV_MAX_HARM + 1], top = 0.0f;
+    size_t at[DECONV_MAX_HARM + 1];
+    for (int k = 1; k <= harmonics; k++) {
+        pk[k] = peak_abs(h + start[k], len[k], &at[k]);
+        top = pk[k] > top ? pk[k] : top;
+    }
+    float scale = top > 0.999f ? 0.999f / top : 1.0f;
+
+    write_ir(argv[4], sr, h, len[1], scale);
+    for (int k = 2; k <= harmonics; k++) {
+        char path[4096], tag[8];
+        snprintf(tag, sizeof tag, "h%d", k);
+        sweep_path(path, sizeof path, argv[4], tag);
+        write_ir(path, sr, h + start[k], len[k], scale);
+    }
+    uint64_t t1 = now_ns();
+
+    fprintf(report(), "impulse response: %zu samples, peak at %.2f ms\n", len[1],
+            1000.0 * (double)at[1] / (double)sr);
+    for (int k = 2; k <= harmonics; k++) {
+        fprintf(report(), "  harmonic %d: %zu samples, peak %.1f dB re linear\n", k, len[k],
+                pk[1] > 0.0f && pk[k] > 0.0f ? 20.0 * log10((double)(pk[k] / pk[1])) : -INFINITY);
+    }
+    if (scale < 1.0f) fprintf(report(), "scaled by %.1f dB to fit 16 bits\n", 20.0 * log10((double)scale));
+    fprintf(report(), "deconvolved %.1f s with a %zu-point FFT in %.3f s\n",
+            (double)ny / (double)sr, n, (double)(t1 - t0) * 1e-9);
+
+    fft_plan_free(plan);
+    free(x); free(y); free(xr); free(xi); free(yr); free(yi); free(zr); free(zi);
+    return 0;
+}
+
+// every processing/analysis mode; serve and client are handled in main()
+static int dispatch(int argc, char **argv) {
+    if (argc < 2) usage();
+
+    const char *mode = argv[1];
+    if (strcmp(mode, "latency") == 0) return run_latency(argc, argv);
+    if (strcmp(mode, "compare") == 0) return run_compare(argc, argv);
+    if (strcmp(mode, "autobench") == 0) return run_autobench(argc, argv);
+    if (strcmp(mode, "limit") == 0 || strcmp(mode, "compress") == 0) return run_dynamics(argc, argv);
+    if (strcmp(mode, "normalize") == 0) return run_normalize(argc, argv);
+    if (strcmp(mode, "loudness") == 0) return run_loudness(argc, argv);
+    if (strcmp(mode, "stft") == 0) return run_stft(argc, argv);
+    if (strcmp(mode, "sweep") == 0) return run_sweep(argc, argv);
+    if (strcmp(mode, "trim") == 0) return run_trim(argc, argv);
+    if (strcmp(mode, "concat") == 0) return run_concat(argc, argv);
+    if (strcmp(mode, "split") == 0) return run_split(argc, argv);
+    if (strcmp(mode, "mix") == 0) return run_mix(argc, argv);
+    if (strcmp(mode, "reverb") == 0) return run_reverb(argc, argv);
+    if (strcmp(mode, "stretch") == 0) return run_stretch(argc, argv);
+    if (strcmp(mode, "pitch") == 0) return run_pitch(argc, argv);
+    if (strcmp(mode, "deconvolve") == 0) return run_deconvolve(argc, argv);
+    if (strcmp(mode, "gain") == 0 || strcmp(mode, "lpf") == 0 ||
+        strcmp(mode, "gainq") == 0 || strcmp(mode, "lpfq") == 0) return run_simple(argc, argv);
+    usage();
+    return 2;
+}
+
+/*
+Output cache.
+
+  wavproc --cache <dir> <mode> <in.wav> <out.wav> <params...>
+
+Outputs are stored as <dir>/<key>.wav, where the key hashes the tool
+version, the mode, its parameters and the hash of the input's audio
+(sample rate + data chunk). On a hit the output is a reflink of the cached
+file where the filesystem can do that (btrfs, XFS, ...) and an in-kernel
+copy otherwise. Not a hard link: the caller may edit its output in place,
+and that must not change what the cache hands out next time.
+
+The input hash is computed while the mode reads its input anyway, so a
+miss costs one extra copy of the output into the cache and nothing else.
+To make the next run a hit without reading the input at all, the input's
+identity (device, inode, size, mtime) is mapped to its content hash in
+<dir>/index/. A changed file has a new mtime and simply misses.
+
+Only single-input, single-output, single-pass modes are cached.
+*/
+static int cacheable_mode(const char *mode) {
+    static const char *modes[] = { "gain", "lpf", "gainq", "lpfq", "limit", "compress" };
+    for (size_t i = 0; i < sizeof modes / sizeof modes[0]; i++) {
+        if (strcmp(mode, modes[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+// copy src to dst (created/truncated): reflink, copy_file_range(), or read/write
+static int copy_file(const char *src, const char *dst) {
+    int in = open(src, O_RDONLY);
+    if (in < 0) return -1;
+    int out = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) {
+        close(in);
+        return -1;
+    }
+    int rc = 0;
+#if defined(__linux__) && defined(FICLONE)
+    if (ioctl(out, FICLONE, in) == 0) {
+        close(in);
+        return close(out);
+    }
+#endif
+    struct stat st;
+    if (fstat(in, &st) != 0) rc = -1;
+    off_t left = rc == 0 ? st.st_size : 0;
+    while (left > 0) {
+        ssize_t k = copy_file_range(in, NULL, out, NULL, (size_t)left, 0);
+        if (k <= 0) break;
+        left -= k;
+    }
+    if (left > 0) {
+        // copy_file_range() not supported here (or across these filesystems)
+        static char buf[1 << 20];
+        if (lseek(in, st.st_size - left, SEEK_SET) < 0) rc = -1;
+        while (rc == 0 && left > 0) {
+            ssize_t k = read(in, buf, sizeof buf);
+            if (k <= 0 || write(out, buf, (size_t)k) != k) rc = -1;
+            else left -= k;
+        }
+    }
+    close(in);
+    if (close(out) != 0) rc = -1;
+    return rc;
+}
+
+// a range selects different audio, so it is part of the identity too
+static void cache_index_path(char *dst, size_t cap, const char *dir, const struct stat *st) {
+    char id[512];
+    int n = snprintf(id, sizeof id, "%llu:%llu:%lld:%lld.%09ld:%s",
+                     (unsigned long long)st->st_dev, (unsigned long long)st->st_ino,
+                     (long long)st->st_size, (long long)st->st_mtim.tv_sec, (long)st->st_mtim.tv_nsec,
+                     range.spec);
+    snprintf(dst, cap, "%s/index/%016llx", dir, (unsigned long long)xxh64(id, (size_t)n, 0));
+}
+
+// key over version, sample rate, content hash, mode and parameters
+static uint64_t cache_key(uint64_t content, uint32_t sample_rate, int argc, char **argv) {
+    xxh64_t h;
+    xxh64_reset(&h, 0);
+    char head[128];
+    int n = snprintf(head, sizeof head, "%s|%u|%016llx", WAVPROC_VERSION, sample_rate,
+                     (unsigned long long)content);
+    xxh64_update(&h, (const uint8_t *)range.spec, strlen(range.spec) + 1);
+    xxh64_update(&h, (const uint8_t *)head, (size_t)n + 1);
+    xxh64_update(&h, (const uint8_t *)argv[1], strlen(argv[1]) + 1);
+    for (int i = 4; i < argc; i++) xxh64_update(&h, (const uint8_t *)argv[i], strlen(argv[i]) + 1);
+    return xxh64_digest(&h);
+}
+
+static int run_cached(const char *dir, int argc, char **argv) {
+    // an automation file's contents are not part of the key; run uncached
+    if (argc < 4 || !cacheable_mode(argv[1]) || (argc > 4 && argv[4][0] == '@')) return dispatch(argc, argv);
+    const char *inpath = argv[2], *outpath = argv[3];
+
+    char path[4096], tmp[4200];
+    snprintf(path, sizeof path, "%s/index", dir);
+    mkdir(dir, 0755);
+    mkdir(path, 0755);
+
+    struct stat st;
+    if (stat(inpath, &st) != 0) die("Could not open input file");
+    char index_path[4096];
+    cache_index_path(index_path, sizeof index_path, dir, &st);
+
+    // known input: look the output up without touching the audio
+    FILE *ix = fopen(index_path, "r");
+    if (ix) {
+        unsigned long long content;
+        unsigned sr;
+        int ok = fscanf(ix, "%llx %u", &content, &sr) == 2;
+        fclose(ix);
+        if (ok) {
+            snprintf(path, sizeof path, "%s/%016llx.wav", dir,
+                     (unsigned long long)cache_key(content, sr, argc, argv));
+            if (copy_file(path, outpath) == 0) return 0;
+        }
+    }
+
+    // miss: run the mode with the read path hashing the data chunk
+    xxh64_t h;
+    xxh64_reset(&h, 0);
+    read_hash = &h;
+    int rc = dispatch(argc, argv);
+    read_hash = NULL;
+    if (rc != 0) return rc;
+    uint64_t content = xxh64_digest(&h);
+
+    // the sample rate is part of the identity of the audio
+    FILE *fin = fopen(inpath, "rb");
+    if (!fin) return 0;
+    wav_info_t in = read_wav_header(fin);
+    fclose(fin);
+
+    // store the output, then publish the index entry (rename() is atomic)
+    snprintf(path, sizeof path, "%s/%016llx.wav", dir,
+             (unsigned long long)cache_key(content, in.sample_rate, argc, argv));
+    snprintf(tmp, sizeof tmp, "%s.%ld.tmp", path, (long)getpid());
+    if (copy_file(outpath, tmp) != 0 || rename(tmp, path) != 0) {
+        remove(tmp);
+        fprintf(stderr, "warning: could not store output in cache %s\n", dir);
+        return 0;
+    }
+    snprintf(tmp, sizeof tmp, "%s.%ld.tmp", index_path, (long)getpid());
+    FILE *f = fopen(tmp, "w");
+    if (f) {
+        fprintf(f, "%016llx %u\n", (unsigned long long)content, in.sample_rate);
+        if (fclose(f) != 0 || rename(tmp, index_path) != 0) remove(tmp);
+    }
+    return 0;
+}
+
+// leading options shared by the command line and daemon jobs
+static int run_command(int argc, char **argv) {
+    const char *cache_dir = NULL;
+    memset(&range, 0, sizeof range);
+
+    while (argc >= 3 && strncmp(argv[1], "--", 2) == 0) {
+        const char *opt = argv[1], *val = argv[2];
+        if (strcmp(opt, "--cache") == 0) {
+            cache_dir = val;
+        } else {
+            wav_pos_t *p = strcmp(opt, "--start") == 0 ? &range.start
+                         : strcmp(opt, "--end") == 0 ? &range.end
+                         : strcmp(opt, "--preroll") == 0 ? &range.preroll : NULL;
+            if (!p) usage();
+            if (parse_pos(val, p) != 0) die("bad position (use samples, <x>s or <x>ms)");
+            size_t used = strlen(range.spec);
+            snprintf(range.spec + used, sizeof range.spec - used, "%s=%s;", opt, val);
+        }
+        // drop the option, keeping argv[0] in front
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
+    if ((range.start.set || range.end.set || range.preroll.set) && argc >= 2) {
+        static const char *const whole[] = { "trim", "split", "concat", "mix", "deconvolve" };
+        for (size_t i = 0; i < sizeof whole / sizeof whole[0]; i++) {
+            if (strcmp(argv[1], whole[i]) == 0) die("--start/--end/--preroll are not supported in this mode");
+        }
+    }
+    if (cache_dir) return run_cached(cache_dir, argc, argv);
+    return dispatch(argc, argv);
+}
+
+/*
+Daemon mode.
+
+  wavproc serve <socket> [workers]
+
+listens on a Unix domain socket and keeps a pool of pre-forked worker
+processes around, so a job costs one round trip instead of a process
+start, dynamic linking and so on. Workers are processes rather than
+threads because every mode reports errors with die(), i.e. exit(): a
+bad input takes down just that worker (after telling the client why),
+and the daemon forks a fresh one.
+
+The socket is SOCK_SEQPACKET, so one packet is one message.
+Request:  <cwd> '\0' <mode> '\0' <arg> '\0' <arg> ...
+          exactly the command line arguments, plus the client's working
+          directory so relative paths mean what the client meant.
+          An argument "fd:N" refers to the N-th file descriptor passed
+          along with the packet (SCM_RIGHTS), for callers that already
+          have the files open.
+Reply:    "ok <microseconds>\n" followed by whatever the mode printed,
+          or "error <message>".
+A connection can carry any number of jobs, one after another.
+*/
+#define DAEMON_MAX_PACKET 65536
+#define DAEMON_MAX_ARGS 64
+#define DAEMON_MAX_FDS 8
+
+static volatile sig_atomic_t daemon_stop = 0;
+
+static void daemon_on_signal(int sig) {
+    (void)sig;
+    daemon_stop = 1;
+}
+
+static void daemon_send(int conn, const char *buf, size_t len) {
+    if (send(conn, buf, len, MSG_NOSIGNAL) != (ssize_t)len) {
+        fprintf(stderr, "wavproc serve: reply failed: %s\n", strerror(errno));
+    }
+}
+
+// run one request packet; returns only on success (die() exits otherwise)
+static void daemon_job(int conn, char *pkt, size_t len, int *fds, int nfds) {
+    uint64_t t0 = now_ns();
+
+    // split on '\0': cwd, then argv[1..]
+    char *args[DAEMON_MAX_ARGS + 1];
+    int nargs = 0;
+    for (size_t i = 0; i < len && nargs < DAEMON_MAX_ARGS;) {
+        args[nargs++] = pkt + i;
+        i += strlen(pkt + i) + 1;
+    }
+    if (nargs < 2) die("empty request");
+    if (chdir(args[0]) != 0) die("could not chdir to client directory");
+
+    // argv[0] is the program name, as usual
+    char fdpaths[DAEMON_MAX_FDS][32];
+    char *argv[DAEMON_MAX_ARGS + 1];
+    int argc = 0;
+    argv[argc++] = "wavproc";
+    for (int i = 1; i < nargs; i++) {
+        if (strncmp(args[i], "fd:", 3) == 0) {
+            long k = strtol(args[i] + 3, NULL, 10);
+            if (k < 0 || k >= nfds) die("fd:N out of range");
+            snprintf(fdpaths[k], sizeof fdpaths[k], "/proc/self/fd/%d", fds[k]);
+            argv[argc++] = fdpaths[k];
+        } else {
+            argv[argc++] = args[i];
+        }
+    }
+    argv[argc] = NULL;
+    if (argc < 2 || strcmp(argv[1], "serve") == 0 || strcmp(argv[1], "client") == 0) die("not a job mode");
+
+    char *rep = NULL;
+    size_t rep_len = 0;
+    report_out = open_memstream(&rep, &rep_len);
+    if (!report_out) die("open_memstream failed");
+
+    job_conn = conn;
+    run_command(argc, argv);
+    job_conn = -1;
+
+    fclose(report_out);
+    report_out = NULL;
+
+    double us = (double)(now_ns() - t0) / 1000.0;
+    size_t cap = rep_len + 64;
+    char *reply = malloc(cap);
+    if (!reply) die("out of memory");
+    int n = snprintf(reply, cap, "ok %.1f\n", us);
+    memcpy(reply + n, rep, rep_len);
+    daemon_send(conn, reply, (size_t)n + rep_len);
+    free(reply);
+    free(rep);
+}
+
+static void daemon_worker(int lfd) {
+    // the request buffer is allocated once and reused for every job
+    char *pkt = malloc(DAEMON_MAX_PACKET + 1);
+    if (!pkt) die("out of memory");
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+
+    for (;;) {
+        int conn = accept(lfd, NULL, NULL);
+        if (conn < 0) {
+            if (errno == EINTR) continue;
+            die("accept failed");
+        }
+        for (;;) {
+            int fds[DAEMON_MAX_FDS];
+            int nfds = 0;
+            union {
+                struct cmsghdr h;
+                char buf[CMSG_SPACE(sizeof(int) * DAEMON_MAX_FDS)];
+            } ctl;
+            struct iovec iov = { pkt, DAEMON_MAX_PACKET };
+            struct msghdr msg;
+            memset(&msg, 0, sizeof msg);
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = ctl.buf;
+            msg.msg_controllen = sizeof ctl.buf;
+
+            ssize_t got = recvmsg(conn, &msg, 0);
+            if (got <= 0) break;   // client closed the connection
+            for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+                if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+                    int k = (int)((c->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+                    for (int i = 0; i < k && nfds < DAEMON_MAX_FDS; i++) {
+                        memcpy(&fds[nfds++], CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+                    }
+                }
+            }
+            pkt[got] = '\0';
+            daemon_job(conn, pkt, (size_t)got, fds, nfds);
+            for (int i = 0; i < nfds; i++) close(fds[i]);
+        }
+        close(conn);
+    }
+}
+
+static int run_serve(int argc, char **argv) {
+    if (argc < 3 || argc > 4) usage();
+    const char *path = argv[2];
+    long workers = argc == 4 ? strtol(argv[3], NULL, 10) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers < 1) workers = 1;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof addr.sun_path) die("socket path too long");
+    strcpy(addr.sun_path, path);
+
+    int lfd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (lfd < 0) die("socket failed");
+    unlink(path);
+    if (bind(lfd, (struct sockaddr *)&addr, sizeof addr) != 0) die("bind failed");
+    if (listen(lfd, 128) != 0) die("listen failed");
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = daemon_on_signal;
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+
+    pid_t *pids = calloc((size_t)workers, sizeof *pids);
+    if (!pids) die("out of memory");
+    fflush(NULL);   // don't let children inherit half-written stdio buffers
+
+    fprintf(stderr, "wavproc serve: listening on %s with %ld workers\n", path, workers);
+    while (!daemon_stop) {
+        // (re)start any worker that is not running
+        for (long w = 0; w < workers; w++) {
+            if (pids[w] > 0) continue;
+            pid_t pid = fork();
+            if (pid < 0) die("fork failed");
+            if (pid == 0) {
+                daemon_worker(lfd);
+                _exit(0);
+            }
+            pids[w] = pid;
+        }
+        int status;
+        pid_t dead = waitpid(-1, &status, 0);
+        if (dead < 0) continue;   // EINTR: a signal, check daemon_stop
+        for (long w = 0; w < workers; w++) {
+            if (pids[w] == dead) pids[w] = 0;
+        }
+    }
+
+    for (long w = 0; w < workers; w++) {
+        if (pids[w] > 0) kill(pids[w], SIGTERM);
+    }
+    for (long w = 0; w < workers; w++) {
+        if (pids[w] > 0) waitpid(pids[w], NULL, 0);
+    }
+    close(lfd);
+    unlink(path);
+    free(pids);
+    return 0;
+}
+
+/*
+Thin client.
+
+  wavproc client <socket> <mode> <args...>    one job
+  wavproc client <socket> -                   one job per line on stdin
+
+Sends the job(s) over one connection, prints what the mode reported and,
+on stderr, the server-side time and the full round trip of every job.
+*/
+static int client_job(int fd, const char *cwd, char **args, int nargs) {
+    static char pkt[DAEMON_MAX_PACKET];
+    static char reply[1 << 20];
+    size_t len = 0;
+    size_t cl = strlen(cwd) + 1;
+    if (cl > sizeof pkt) die("request too long");
+    memcpy(pkt, cwd, cl);
+    len = cl;
+    for (int i = 0; i < nargs; i++) {
+        size_t al = strlen(args[i]) + 1;
+        if (len + al > sizeof pkt) die("request too long");
+        memcpy(pkt + len, args[i], al);
+        len += al;
+    }
+
+    uint64_t t0 = now_ns();
+    if (send(fd, pkt, len, MSG_NOSIGNAL) != (ssize_t)len) die("send failed");
+    ssize_t got = recv(fd, reply, sizeof reply - 1, 0);
+    uint64_t t1 = now_ns();
+    if (got <= 0) die("no reply from server");
+    reply[got] = '\0';
+
+    if (strncmp(reply, "ok ", 3) == 0) {
+        char *nl = strchr(reply, '\n');
+        double server_us = strtod(reply + 3, NULL);
+        if (nl) fputs(nl + 1, stdout);
+        fprintf(stderr, "%s: ok, %.1f us in server, %.1f us round trip\n",
+                args[0], server_us, (double)(t1 - t0) / 1000.0);
+        return 0;
+    }
+    fprintf(stderr, "%s: %s\n", args[0], reply);
+    return 1;
+}
+
+static int client_connect(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof addr.sun_path) die("socket path too long");
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (fd < 0) die("socket failed");
+    if (connect(fd, (struct sockaddr *)&addr, sizeof addr) != 0) die("could not connect to server");
+    return fd;
+}
+
+static int run_client(int argc, char **argv) {
+    if (argc < 4) usage();
+    char cwd[4096];
+    if (!getcwd(cwd, sizeof cwd)) die("getcwd failed");
+
+    // a job that fails makes the server drop that worker, and with it the
+    // connection, so reconnect before the next one
+    int fd = client_connect(argv[2]);
+    if (strcmp(argv[3], "-") != 0) {
+        int rc = client_job(fd, cwd, argv + 3, argc - 3);
+        close(fd);
+        return rc;
+    }
+
+    int failed = 0;
+    char line[8192];
+    while (fgets(line, sizeof line, stdin)) {
+        char *args[DAEMON_MAX_ARGS];
+        int nargs = 0;
+        for (char *tok = strtok(line, " \t\r\n"); tok && nargs < DAEMON_MAX_ARGS;
+             tok = strtok(NULL, " \t\r\n")) {
+            args[nargs++] = tok;
+        }
+        if (nargs == 0 || args[0][0] == '#') continue;
+        if (client_job(fd, cwd, args, nargs) != 0) {
+            failed++;
+            close(fd);
+            fd = client_connect(argv[2]);
+        }
+    }
+    close(fd);
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc >= 2 && strcmp(argv[1], "serve") == 0) return run_serve(argc, argv);
+    if (argc >= 2 && strcmp(argv[1], "client") == 0) return run_client(argc, argv);
+    return run_command(argc, argv);
+}